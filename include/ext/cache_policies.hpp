@@ -0,0 +1,654 @@
+#pragma once
+// Eviction policies of manual_lru_cache/lru_cache/batch_lru_cache/concurrent_lru_cache.
+//
+// Pure lru is flushed by scans: every element of one-time full scan becomes most recently used
+// and pushes out whole working set. Provided policies:
+// * lru_policy     - classic lru, default;
+// * clock_policy   - CLOCK(second chance): hit only sets referenced bit, there is no relocation in list on hit,
+//                    eviction advances hand over list giving referenced elements second chance. Cheaper hits, lru-like hit rate;
+// * arc_policy     - Adaptive Replacement Cache: recency and frequency segments plus ghost lists of recently evicted keys,
+//                    balance between segments adapts to workload. Scanned elements pass through recency segment only;
+// * tinylfu_policy - W-TinyLFU: small lru window takes new elements, main segmented lru space(probation/protected)
+//                    admits element from window only if it's estimated frequency is higher than frequency of main victim.
+//                    Frequencies are estimated by count-min sketch with periodic aging. Best scan resistance.
+//
+// All elements are kept in one sequenced list, policy orders it as it wants,
+// segmented policies keep segments as contiguous ranges of that list.
+// Capacities are in weight units, same as cache maxsize, see lru_unit_weigher.
+//
+// Policy interface. Policy is a tag type with:
+//   entry_data    - per element metadata, default constructible, kept in element as mutable member policy_data;
+//   needs_hash    - whether hooks need hash of element key, 0 is passed otherwise;
+//   impl<List>    - implementation over sequenced index List, elements of which have members weight and policy_data:
+//     void set_capacity(std::size_t capacity);
+//     void clear();
+//     void on_insert(List & list, iterator it, std::size_t hash);                         - new element, placed at back of list
+//     void on_access(List & list, iterator it, std::size_t hash);                         - element is found by lookup
+//     void on_update(List & list, iterator it, std::size_t hash, std::size_t old_weight); - value of element is replaced
+//     iterator victim(List & list, iterator keep);                                        - element to evict other than keep, list.end() if there is none
+//     void on_evict(List & list, iterator it, std::size_t hash);                          - victim is about to be erased
+//     void on_erase(List & list, iterator it);                                            - element is about to be erased by user
+
+#include <cstdint>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/member.hpp>
+
+namespace ext
+{
+	/************************************************************************/
+	/*                          lru                                         */
+	/************************************************************************/
+	template <class List>
+	class lru_policy_impl
+	{
+	public:
+		typedef typename List::iterator iterator;
+
+	public:
+		void set_capacity(std::size_t capacity) noexcept {}
+		void clear() noexcept {}
+
+		void on_insert(List & list, iterator it, std::size_t hash) noexcept {}
+		void on_access(List & list, iterator it, std::size_t hash) noexcept { list.relocate(list.end(), it); }
+		void on_update(List & list, iterator it, std::size_t hash, std::size_t old_weight) noexcept { list.relocate(list.end(), it); }
+
+		iterator victim(List & list, iterator keep) noexcept
+		{
+			auto it = list.begin();
+			if (it != list.end() and it == keep) ++it;
+			return it;
+		}
+
+		void on_evict(List & list, iterator it, std::size_t hash) noexcept {}
+		void on_erase(List & list, iterator it) noexcept {}
+	};
+
+	struct lru_policy
+	{
+		struct entry_data {};
+		static constexpr bool needs_hash = false;
+
+		template <class List>
+		using impl = lru_policy_impl<List>;
+	};
+
+	/************************************************************************/
+	/*                          clock                                       */
+	/************************************************************************/
+	template <class List>
+	class clock_policy_impl
+	{
+	public:
+		typedef typename List::iterator iterator;
+
+	public:
+		void set_capacity(std::size_t capacity) noexcept {}
+		void clear() noexcept {}
+
+		// list is the clock, it's front is the hand: new element is placed right behind the hand
+		void on_insert(List & list, iterator it, std::size_t hash) noexcept {}
+		void on_access(List & list, iterator it, std::size_t hash) noexcept { it->policy_data.referenced = true; }
+		void on_update(List & list, iterator it, std::size_t hash, std::size_t old_weight) noexcept { it->policy_data.referenced = true; }
+
+		iterator victim(List & list, iterator keep) noexcept;
+
+		void on_evict(List & list, iterator it, std::size_t hash) noexcept {}
+		void on_erase(List & list, iterator it) noexcept {}
+	};
+
+	template <class List>
+	auto clock_policy_impl<List>::victim(List & list, iterator keep) noexcept -> iterator
+	{
+		// referenced elements lose their bit and are passed by the hand - moved behind it.
+		// After one full turn all bits are cleared, so loop is bounded
+		for (auto n = 2 * list.size(); n; --n)
+		{
+			auto it = list.begin();
+			if (it != keep and not it->policy_data.referenced)
+				return it;
+
+			it->policy_data.referenced = false;
+			list.relocate(list.end(), it);
+		}
+
+		return list.end();
+	}
+
+	struct clock_policy
+	{
+		struct entry_data { bool referenced = false; };
+		static constexpr bool needs_hash = false;
+
+		template <class List>
+		using impl = clock_policy_impl<List>;
+	};
+
+	/************************************************************************/
+	/*                   helpers of segmented policies                      */
+	/************************************************************************/
+	/// contiguous segments of policy list: segment s occupies range [begin(s), begin(s + 1)),
+	/// most recently used element of segment is the last one. Segment of element is kept in it's policy_data.segment
+	template <class List, unsigned Count>
+	class cache_list_segments
+	{
+	public:
+		typedef typename List::iterator iterator;
+
+	private:
+		iterator m_first[Count];            // first element of segment, valid only if segment is not empty
+		std::size_t m_count[Count] = {};
+		std::size_t m_weight[Count] = {};
+
+	public:
+		std::size_t count(unsigned s)  const noexcept { return m_count[s]; }
+		std::size_t weight(unsigned s) const noexcept { return m_weight[s]; }
+
+		iterator begin(List & list, unsigned s) const noexcept
+		{
+			for (; s < Count; ++s)
+				if (m_count[s]) return m_first[s];
+
+			return list.end();
+		}
+
+		iterator end(List & list, unsigned s) const noexcept { return begin(list, s + 1); }
+
+		/// least recently used element of segment other than keep, list.end() if there is none
+		iterator lru(List & list, unsigned s, iterator keep) const noexcept
+		{
+			if (not m_count[s]) return list.end();
+
+			auto it = m_first[s];
+			if (it == keep and ++it == end(list, s))
+				return list.end();
+
+			return it;
+		}
+
+		/// removes element from bookkeeping of it's segment, element stays in list
+		void remove(iterator it) noexcept
+		{
+			unsigned s = it->policy_data.segment;
+			if (--m_count[s] and m_first[s] == it) m_first[s] = std::next(it);
+			m_weight[s] -= it->weight;
+		}
+
+		/// places element, not belonging to any segment, at most recently used position of segment s
+		void push_back(List & list, iterator it, unsigned s) noexcept
+		{
+			list.relocate(end(list, s), it);
+			if (not m_count[s]++) m_first[s] = it;
+			m_weight[s] += it->weight;
+			it->policy_data.segment = static_cast<unsigned char>(s);
+		}
+
+		/// moves element to most recently used position of segment s
+		void move_back(List & list, iterator it, unsigned s) noexcept
+		{
+			remove(it);
+			push_back(list, it, s);
+		}
+
+		/// accounts changed weight of element
+		void reweigh(iterator it, std::size_t old_weight) noexcept
+		{
+			auto & weight = m_weight[it->policy_data.segment];
+			weight = weight - old_weight + it->weight;
+		}
+
+		void clear() noexcept
+		{
+			std::fill(std::begin(m_count), std::end(m_count), 0);
+			std::fill(std::begin(m_weight), std::end(m_weight), 0);
+		}
+	};
+
+	/// hashes of keys of recently evicted elements with their weights, in lru order
+	class cache_ghost_list
+	{
+		struct ghost
+		{
+			std::size_t hash;
+			std::size_t weight;
+		};
+
+		typedef boost::multi_index_container <
+			ghost,
+			boost::multi_index::indexed_by<
+				boost::multi_index::hashed_unique<
+					boost::multi_index::member<ghost, std::size_t, &ghost::hash>
+				>,
+				boost::multi_index::sequenced<>
+			>
+		> ghost_container;
+
+		static const std::size_t ByHash = 0;
+		static const std::size_t ByPos = 1;
+
+	private:
+		ghost_container m_ghosts;
+		std::size_t m_weight = 0;
+
+	public:
+		bool empty() const noexcept { return m_ghosts.empty(); }
+		std::size_t weight() const noexcept { return m_weight; }
+
+		/// removes ghost, returns false if there is no such one
+		bool erase(std::size_t hash) noexcept
+		{
+			auto it = m_ghosts.find(hash);
+			if (it == m_ghosts.end())
+				return false;
+
+			m_weight -= it->weight;
+			m_ghosts.erase(it);
+			return true;
+		}
+
+		void push_back(std::size_t hash, std::size_t weight)
+		{
+			erase(hash);
+			m_ghosts.template get<ByPos>().push_back({hash, weight});
+			m_weight += weight;
+		}
+
+		/// removes least recently added ghost
+		void pop_front() noexcept
+		{
+			auto & pv = m_ghosts.template get<ByPos>();
+			m_weight -= pv.front().weight;
+			pv.pop_front();
+		}
+
+		void clear() noexcept
+		{
+			m_ghosts.clear();
+			m_weight = 0;
+		}
+	};
+
+	/// count-min sketch of 4 rows with 8 bit counters saturating at 15(as 4 bit counters of Caffeine).
+	/// All counters are halved after 10 * width increments, so old popularity fades out
+	class frequency_sketch
+	{
+		static constexpr unsigned depth = 4;
+		static constexpr std::uint8_t max_count = 15;
+
+	private:
+		std::vector<std::uint8_t> m_table;
+		std::size_t m_mask = 0;
+		std::size_t m_additions = 0;
+		std::size_t m_sample_size = 0;
+
+	private:
+		std::size_t index(std::size_t hash, unsigned row) const noexcept
+		{
+			// different seed per row gives independent enough indexes
+			static constexpr std::uint64_t seeds[depth] = {
+				0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+			};
+
+			std::uint64_t h = (static_cast<std::uint64_t>(hash) + seeds[row]) * 0x9e3779b97f4a7c15ULL;
+			h ^= h >> 32;
+			return row * (m_mask + 1) + static_cast<std::size_t>(h & m_mask);
+		}
+
+		void age() noexcept
+		{
+			for (auto & counter : m_table)
+				counter >>= 1;
+
+			m_additions /= 2;
+		}
+
+	public:
+		std::size_t width() const noexcept { return m_table.empty() ? 0 : m_mask + 1; }
+
+		/// resets sketch with given width of row, rounded up to power of 2
+		void resize(std::size_t width)
+		{
+			std::size_t pow2 = 1;
+			while (pow2 < width) pow2 <<= 1;
+
+			m_table.assign(depth * pow2, 0);
+			m_mask = pow2 - 1;
+			m_sample_size = 10 * pow2;
+			m_additions = 0;
+		}
+
+		void clear() noexcept
+		{
+			std::fill(m_table.begin(), m_table.end(), 0);
+			m_additions = 0;
+		}
+
+		void increment(std::size_t hash) noexcept
+		{
+			if (m_table.empty()) return;
+
+			bool added = false;
+			for (unsigned row = 0; row < depth; ++row)
+			{
+				auto & counter = m_table[index(hash, row)];
+				if (counter < max_count)
+				{
+					++counter;
+					added = true;
+				}
+			}
+
+			if (added and ++m_additions >= m_sample_size)
+				age();
+		}
+
+		unsigned frequency(std::size_t hash) const noexcept
+		{
+			if (m_table.empty()) return 0;
+
+			unsigned result = max_count;
+			for (unsigned row = 0; row < depth; ++row)
+				result = std::min<unsigned>(result, m_table[index(hash, row)]);
+
+			return result;
+		}
+	};
+
+	/************************************************************************/
+	/*                          arc                                         */
+	/************************************************************************/
+	template <class List>
+	class arc_policy_impl
+	{
+	public:
+		typedef typename List::iterator iterator;
+
+	private:
+		// T1 and T2 of ARC paper
+		enum : unsigned { recent_segment = 0, frequent_segment = 1 };
+
+		cache_list_segments<List, 2> m_segments;
+		// B1 and B2 of ARC paper
+		cache_ghost_list m_recent_ghosts, m_frequent_ghosts;
+
+		std::size_t m_capacity = 0;
+		// target weight of recent segment, p of ARC paper
+		std::size_t m_target = 0;
+		// last miss was found in frequent ghosts, affects choice of victim segment
+		bool m_frequent_ghost_hit = false;
+
+	private:
+		void trim_ghosts() noexcept;
+
+	public:
+		void set_capacity(std::size_t capacity) noexcept;
+		void clear() noexcept;
+
+		void on_insert(List & list, iterator it, std::size_t hash);
+		void on_access(List & list, iterator it, std::size_t hash) noexcept { m_segments.move_back(list, it, frequent_segment); }
+		void on_update(List & list, iterator it, std::size_t hash, std::size_t old_weight) noexcept
+		{
+			m_segments.reweigh(it, old_weight);
+			m_segments.move_back(list, it, frequent_segment);
+		}
+
+		iterator victim(List & list, iterator keep) noexcept;
+
+		void on_evict(List & list, iterator it, std::size_t hash);
+		void on_erase(List & list, iterator it) noexcept { m_segments.remove(it); }
+	};
+
+	template <class List>
+	void arc_policy_impl<List>::trim_ghosts() noexcept
+	{
+		// recent segment with it's ghosts fits capacity, everything together - twice capacity
+		while (not m_recent_ghosts.empty() and m_segments.weight(recent_segment) + m_recent_ghosts.weight() > m_capacity)
+			m_recent_ghosts.pop_front();
+
+		auto total = [this] {
+			return m_segments.weight(recent_segment) + m_segments.weight(frequent_segment)
+			     + m_recent_ghosts.weight() + m_frequent_ghosts.weight();
+		};
+
+		while (not m_frequent_ghosts.empty() and total() > 2 * m_capacity)
+			m_frequent_ghosts.pop_front();
+	}
+
+	template <class List>
+	void arc_policy_impl<List>::set_capacity(std::size_t capacity) noexcept
+	{
+		m_capacity = capacity;
+		m_target = std::min(m_target, capacity);
+		trim_ghosts();
+	}
+
+	template <class List>
+	void arc_policy_impl<List>::clear() noexcept
+	{
+		m_segments.clear();
+		m_recent_ghosts.clear();
+		m_frequent_ghosts.clear();
+		m_target = 0;
+		m_frequent_ghost_hit = false;
+	}
+
+	template <class List>
+	void arc_policy_impl<List>::on_insert(List & list, iterator it, std::size_t hash)
+	{
+		auto weight = it->weight;
+		auto recent_ghosts = m_recent_ghosts.weight();
+		auto frequent_ghosts = m_frequent_ghosts.weight();
+
+		if (m_recent_ghosts.erase(hash))
+		{	// evicted from recent segment too early - it should be bigger
+			auto ratio = recent_ghosts ? std::max<std::size_t>(1, frequent_ghosts / recent_ghosts) : 1;
+			m_target = std::min(m_capacity, m_target + weight * ratio);
+			m_segments.push_back(list, it, frequent_segment);
+		}
+		else if (m_frequent_ghosts.erase(hash))
+		{	// evicted from frequent segment too early - recent one should be smaller
+			auto ratio = frequent_ghosts ? std::max<std::size_t>(1, recent_ghosts / frequent_ghosts) : 1;
+			m_target -= std::min(m_target, weight * ratio);
+			m_frequent_ghost_hit = true;
+			m_segments.push_back(list, it, frequent_segment);
+		}
+		else
+			m_segments.push_back(list, it, recent_segment);
+	}
+
+	template <class List>
+	auto arc_policy_impl<List>::victim(List & list, iterator keep) noexcept -> iterator
+	{
+		auto recent_weight = m_segments.weight(recent_segment);
+		bool from_recent = recent_weight > m_target or (m_frequent_ghost_hit and recent_weight == m_target);
+
+		unsigned first  = from_recent ? recent_segment : frequent_segment;
+		unsigned second = from_recent ? frequent_segment : recent_segment;
+
+		auto it = m_segments.lru(list, first, keep);
+		if (it == list.end()) it = m_segments.lru(list, second, keep);
+		return it;
+	}
+
+	template <class List>
+	void arc_policy_impl<List>::on_evict(List & list, iterator it, std::size_t hash)
+	{
+		auto & ghosts = it->policy_data.segment == recent_segment ? m_recent_ghosts : m_frequent_ghosts;
+		m_segments.remove(it);
+		ghosts.push_back(hash, it->weight);
+
+		m_frequent_ghost_hit = false;
+		trim_ghosts();
+	}
+
+	struct arc_policy
+	{
+		struct entry_data { unsigned char segment = 0; };
+		static constexpr bool needs_hash = true;
+
+		template <class List>
+		using impl = arc_policy_impl<List>;
+	};
+
+	/************************************************************************/
+	/*                          w-tinylfu                                   */
+	/************************************************************************/
+	template <class List>
+	class tinylfu_policy_impl
+	{
+	public:
+		typedef typename List::iterator iterator;
+
+		/// share of window in capacity and share of protected segment in main space, in percents
+		static constexpr std::size_t window_percent = 1;
+		static constexpr std::size_t protected_percent = 80;
+		/// sketch width is capacity clamped to this range
+		static constexpr std::size_t sketch_min_width = 16;
+		static constexpr std::size_t sketch_max_width = 1 << 16;
+
+	private:
+		enum : unsigned { window_segment = 0, probation_segment = 1, protected_segment = 2 };
+
+		cache_list_segments<List, 3> m_segments;
+		frequency_sketch m_sketch;
+
+		std::size_t m_window_capacity = 0;
+		std::size_t m_main_capacity = 0;
+		std::size_t m_protected_capacity = 0;
+
+	private:
+		/// moves element from probation to protected, protected overflow is demoted back to probation
+		void promote(List & list, iterator it) noexcept;
+		/// floor(value * percent / 100) without overflow
+		static std::size_t percent_of(std::size_t value, std::size_t percent) noexcept
+		{ return value / 100 * percent + value % 100 * percent / 100; }
+
+	public:
+		void set_capacity(std::size_t capacity);
+		void clear() noexcept;
+
+		void on_insert(List & list, iterator it, std::size_t hash) noexcept;
+		void on_access(List & list, iterator it, std::size_t hash) noexcept;
+		void on_update(List & list, iterator it, std::size_t hash, std::size_t old_weight) noexcept
+		{
+			m_segments.reweigh(it, old_weight);
+			on_access(list, it, hash);
+		}
+
+		iterator victim(List & list, iterator keep) noexcept;
+
+		void on_evict(List & list, iterator it, std::size_t hash) noexcept { m_segments.remove(it); }
+		void on_erase(List & list, iterator it) noexcept { m_segments.remove(it); }
+	};
+
+	template <class List>
+	void tinylfu_policy_impl<List>::set_capacity(std::size_t capacity)
+	{
+		m_window_capacity = std::max<std::size_t>(1, percent_of(capacity, window_percent));
+		m_main_capacity = capacity > m_window_capacity ? capacity - m_window_capacity : 0;
+		m_protected_capacity = percent_of(m_main_capacity, protected_percent);
+
+		auto width = std::clamp(capacity, sketch_min_width, sketch_max_width);
+		if (m_sketch.width() < width)
+			m_sketch.resize(width);
+	}
+
+	template <class List>
+	void tinylfu_policy_impl<List>::clear() noexcept
+	{
+		m_segments.clear();
+		m_sketch.clear();
+	}
+
+	template <class List>
+	void tinylfu_policy_impl<List>::promote(List & list, iterator it) noexcept
+	{
+		m_segments.move_back(list, it, protected_segment);
+		while (m_segments.weight(protected_segment) > m_protected_capacity)
+		{
+			auto lru = m_segments.lru(list, protected_segment, it);
+			if (lru == list.end()) break;
+
+			m_segments.move_back(list, lru, probation_segment);
+		}
+	}
+
+	template <class List>
+	void tinylfu_policy_impl<List>::on_insert(List & list, iterator it, std::size_t hash) noexcept
+	{
+		m_sketch.increment(hash);
+		it->policy_data.hash = hash;
+		m_segments.push_back(list, it, window_segment);
+	}
+
+	template <class List>
+	void tinylfu_policy_impl<List>::on_access(List & list, iterator it, std::size_t hash) noexcept
+	{
+		m_sketch.increment(hash);
+		switch (it->policy_data.segment)
+		{
+			case window_segment:    m_segments.move_back(list, it, window_segment);    break;
+			case probation_segment: promote(list, it);                                 break;
+			case protected_segment: m_segments.move_back(list, it, protected_segment); break;
+		}
+	}
+
+	template <class List>
+	auto tinylfu_policy_impl<List>::victim(List & list, iterator keep) noexcept -> iterator
+	{
+		// window is over it's share: it's lru element is candidate for main space
+		while (m_segments.weight(window_segment) > m_window_capacity)
+		{
+			auto candidate = m_segments.lru(list, window_segment, keep);
+			if (candidate == list.end()) break;
+
+			auto main_weight = m_segments.weight(probation_segment) + m_segments.weight(protected_segment);
+			auto victim = m_segments.lru(list, probation_segment, keep);
+			if (victim == list.end()) victim = m_segments.lru(list, protected_segment, keep);
+
+			// main space is not full yet or there is nobody to compete with - admitted for free
+			if (main_weight + candidate->weight <= m_main_capacity or victim == list.end())
+			{
+				m_segments.move_back(list, candidate, probation_segment);
+				continue;
+			}
+
+			// candidate replaces victim only if it's more popular, ties are won by victim - scanned elements do not get in
+			if (m_sketch.frequency(candidate->policy_data.hash) > m_sketch.frequency(victim->policy_data.hash))
+			{
+				m_segments.move_back(list, candidate, probation_segment);
+				return victim;
+			}
+
+			return candidate;
+		}
+
+		// window is within it's share - main space is over capacity
+		for (unsigned s : {probation_segment, protected_segment, window_segment})
+		{
+			auto it = m_segments.lru(list, s, keep);
+			if (it != list.end()) return it;
+		}
+
+		return list.end();
+	}
+
+	struct tinylfu_policy
+	{
+		struct entry_data
+		{
+			std::size_t hash = 0;
+			unsigned char segment = 0;
+		};
+
+		static constexpr bool needs_hash = true;
+
+		template <class List>
+		using impl = tinylfu_policy_impl<List>;
+	};
+}
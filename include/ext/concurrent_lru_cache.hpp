@@ -0,0 +1,340 @@
+#pragma once
+// Thread-safe lru cache, built from hash-sharded manual_lru_cache segments.
+//
+// Keys are distributed over N shards by hash, every shard is manual_lru_cache with it's own lock,
+// so operations on different shards do not contend. Capacity is split evenly between shards(sum is exactly maxsize),
+// eviction is lru(or other Policy) within shard - approximation of global one, good enough for uniformly hashed keys.
+//
+// In plain lru every lookup is a write: found element is moved to the end of lru list.
+// Two update modes are supported:
+// * immediate - lookup takes exclusive shard lock and updates recency right away, exact lru within shard;
+// * buffered  - read-mostly mode, lookup takes shared lock and only records access into small per shard buffer,
+//               buffer is applied under exclusive lock when it's full or by next write to shard(like Caffeine does).
+//               Recording is lossy - if buffer is busy or full, access is dropped, so recency becomes approximate,
+//               but lookups of hot keys do not serialize on shard lock.
+//
+// Since elements can be evicted by other threads any moment, values are returned by copy,
+// use shared_ptr like Value for heavy objects.
+//
+// Like manual_lru_cache, capacity is total weight of elements computed by Weigher, number of elements by default.
+
+#include <limits>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <optional>
+#include <vector>
+#include <stdexcept>
+#include <functional>
+#include <ext/lrucache.hpp>
+
+namespace ext
+{
+	/// recency update mode of concurrent_lru_cache, see description at top of this file
+	enum class lru_update_mode : unsigned
+	{
+		immediate, // lookups update recency under exclusive shard lock
+		buffered,  // lookups take shared lock, recency updates are buffered and applied in batches
+	};
+
+	/// thread-safe hash-sharded lru cache, see description at top of this file.
+	/// Acquire is used by at to obtain missing values, expression Value v = Acquire(key) must be valid.
+	/// Cache can be used without Acquire via find/insert methods.
+	/// Weigher - see manual_lru_cache, Policy - eviction policy within shard, see ext/cache_policies.hpp.
+	template <
+		class Key,
+		class Value,
+		class Hash = boost::hash<Key>,
+		class KeyEqual = std::equal_to<>,
+		class Acquire = std::function<Value(const Key &)>,
+		class Weigher = lru_unit_weigher,
+		class Policy = lru_policy
+	>
+	class concurrent_lru_cache
+	{
+		typedef manual_lru_cache<Key, Value, Hash, KeyEqual, Weigher, Policy> segment_type;
+
+	public:
+		typedef typename segment_type::key_type key_type;
+		typedef typename segment_type::mapped_type mapped_type;
+		typedef typename segment_type::hasher hasher;
+		typedef typename segment_type::key_equal key_equal;
+		typedef typename segment_type::key_param key_param;
+		typedef typename segment_type::value_param value_param;
+		typedef typename segment_type::weigher_type weigher_type;
+		typedef typename segment_type::policy_type policy_type;
+
+		/// number of shards used if 0 is given to constructor
+		static constexpr std::size_t default_shard_count = 16;
+		/// capacity of per shard access buffer in buffered mode
+		static constexpr std::size_t access_buffer_size = 64;
+
+	private:
+		static constexpr std::size_t cacheline_size = 64;
+
+		struct alignas(cacheline_size) shard
+		{
+			std::shared_mutex mutex;
+			segment_type cache;
+
+			// buffered mode: recorded accesses and their batch being applied(only under exclusive mutex)
+			std::mutex buffer_mutex;
+			std::vector<key_type> buffer;
+			std::vector<key_type> drain;
+
+			shard(std::size_t maxsize, const weigher_type & weigher) : cache(maxsize, weigher) {}
+		};
+
+	private:
+		hasher m_hash;
+		Acquire m_acquire;
+		lru_update_mode m_mode;
+		std::size_t m_maxsize;
+		std::size_t m_shard_count;
+		std::vector<std::unique_ptr<shard>> m_shards;
+
+	private:
+		shard & shard_for(key_param key) const;
+		/// capacity of shard idx: maxsize split evenly, first maxsize % shard_count shards get one unit more
+		static std::size_t shard_maxsize(std::size_t maxsize, std::size_t shard_count, std::size_t idx) noexcept;
+
+		/// records access in buffered mode, returns true if buffer should be drained
+		bool record_access(shard & sh, key_param key);
+		/// applies buffered accesses, exclusive shard mutex must be held
+		void drain_buffer(shard & sh);
+
+	public:
+		/// finds value by key, updates recency. Returns copy of value or empty optional if there is no such key
+		std::optional<mapped_type> find(key_param key);
+		/// finds value by key, if there is no such key - obtains it via Acquire and inserts into cache.
+		/// Acquire is called without holding any lock, so concurrent misses of same key can call it multiple times,
+		/// last inserted value wins. Exceptions from Acquire are propagated, nothing is inserted then
+		mapped_type at(key_param key);
+
+		/// inserts or replaces value for key, evicts least recently used element of shard if it's full
+		void insert(key_type key, mapped_type value);
+		/// erases element by key, returns false if there is no such element
+		bool erase(key_param key);
+
+		/// clears cache
+		void clear();
+		/// current number of elements, sum of shard sizes - only approximate in presence of concurrent modifications
+		std::size_t size() const;
+		/// current total weight of elements, same as size with default weigher
+		std::size_t weight() const;
+		std::size_t maxsize() const noexcept { return m_maxsize; }
+		std::size_t shard_count() const noexcept { return m_shard_count; }
+		lru_update_mode update_mode() const noexcept { return m_mode; }
+
+		/// changes capacity, split evenly between shards, evicts excessive elements.
+		/// Not synchronized with other set_maxsize calls.
+		/// Throws std::invalid_argument if size < shard_count(): every shard must hold at least 1 element
+		void set_maxsize(std::size_t size);
+
+	public:
+		/// nshards - number of shards, 0 - default_shard_count, clamped to maxsize so every shard holds at least 1 element.
+		/// Throws std::invalid_argument if maxsize == 0
+		explicit concurrent_lru_cache(std::size_t maxsize, Acquire ac = Acquire(),
+		                              std::size_t nshards = 0, lru_update_mode mode = lru_update_mode::immediate,
+		                              weigher_type weigher = weigher_type());
+
+		concurrent_lru_cache(const concurrent_lru_cache &) = delete;
+		concurrent_lru_cache & operator =(const concurrent_lru_cache &) = delete;
+	};
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	auto concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::shard_for(key_param key) const -> shard &
+	{
+		// shard's hashed index uses low bits of same hash, mix them before choosing shard
+		constexpr unsigned shift = std::numeric_limits<std::size_t>::digits / 2;
+		std::size_t hash = m_hash(key);
+		hash ^= hash >> shift;
+		hash *= static_cast<std::size_t>(0x9e3779b97f4a7c15ULL);
+		hash ^= hash >> shift;
+
+		return *m_shards[hash % m_shard_count];
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	std::size_t concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::shard_maxsize(std::size_t maxsize, std::size_t shard_count, std::size_t idx) noexcept
+	{
+		return maxsize / shard_count + (idx < maxsize % shard_count);
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	bool concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::record_access(shard & sh, key_param key)
+	{
+		std::unique_lock lk(sh.buffer_mutex, std::try_to_lock);
+		// busy - someone else records or drains, access is just lost
+		if (not lk) return false;
+
+		if (sh.buffer.size() >= access_buffer_size)
+			return true;
+
+		sh.buffer.push_back(key);
+		return sh.buffer.size() >= access_buffer_size;
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	void concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::drain_buffer(shard & sh)
+	{
+		{
+			std::lock_guard lk(sh.buffer_mutex);
+			sh.buffer.swap(sh.drain);
+		}
+
+		// keys evicted since access was recorded are just skipped
+		for (auto & key : sh.drain)
+			sh.cache.touch(key);
+
+		sh.drain.clear();
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	auto concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::find(key_param key) -> std::optional<mapped_type>
+	{
+		auto & sh = shard_for(key);
+		if (m_mode == lru_update_mode::immediate)
+		{
+			std::lock_guard lk(sh.mutex);
+			auto * val = sh.cache.find_ptr(key);
+			if (not val) return std::nullopt;
+			return *val;
+		}
+
+		std::optional<mapped_type> result;
+		{
+			std::shared_lock lk(sh.mutex);
+			auto * val = sh.cache.peek_ptr(key);
+			if (not val) return std::nullopt;
+			result.emplace(*val);
+		}
+
+		if (record_access(sh, key))
+		{
+			// buffer is full: apply it, if shard is busy - some writer will do it
+			std::unique_lock lk(sh.mutex, std::try_to_lock);
+			if (lk) drain_buffer(sh);
+		}
+
+		return result;
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	auto concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::at(key_param key) -> mapped_type
+	{
+		auto result = find(key);
+		if (result) return std::move(*result);
+
+		mapped_type val = m_acquire(key);
+		insert(key, val);
+		return val;
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	void concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::insert(key_type key, mapped_type value)
+	{
+		auto & sh = shard_for(key);
+		std::lock_guard lk(sh.mutex);
+		// recency should be up to date before choosing eviction victim
+		if (m_mode == lru_update_mode::buffered)
+			drain_buffer(sh);
+
+		sh.cache.insert(std::move(key), std::move(value));
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	bool concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::erase(key_param key)
+	{
+		auto & sh = shard_for(key);
+		std::lock_guard lk(sh.mutex);
+		return sh.cache.erase(key);
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	void concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::clear()
+	{
+		for (std::size_t idx = 0; idx < m_shard_count; ++idx)
+		{
+			auto & sh = *m_shards[idx];
+			std::lock_guard lk(sh.mutex);
+			sh.cache.clear();
+
+			std::lock_guard buffer_lk(sh.buffer_mutex);
+			sh.buffer.clear();
+		}
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	std::size_t concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::size() const
+	{
+		std::size_t result = 0;
+		for (std::size_t idx = 0; idx < m_shard_count; ++idx)
+		{
+			auto & sh = *m_shards[idx];
+			std::shared_lock lk(sh.mutex);
+			result += sh.cache.size();
+		}
+
+		return result;
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	std::size_t concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::weight() const
+	{
+		std::size_t result = 0;
+		for (std::size_t idx = 0; idx < m_shard_count; ++idx)
+		{
+			auto & sh = *m_shards[idx];
+			std::shared_lock lk(sh.mutex);
+			result += sh.cache.weight();
+		}
+
+		return result;
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	void concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::set_maxsize(std::size_t size)
+	{
+		// number of shards is fixed, every shard should hold at least 1 element,
+		// so smaller size can't be honored - cache would keep more elements than maxsize reports
+		if (size < m_shard_count)
+			throw std::invalid_argument("concurrent_lru_cache: CacheMaxSize < shard count is invalid");
+
+		for (std::size_t idx = 0; idx < m_shard_count; ++idx)
+		{
+			auto & sh = *m_shards[idx];
+			std::lock_guard lk(sh.mutex);
+			if (m_mode == lru_update_mode::buffered)
+				drain_buffer(sh);
+
+			sh.cache.set_maxsize(shard_maxsize(size, m_shard_count, idx));
+		}
+
+		m_maxsize = size;
+	}
+
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	concurrent_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy>::concurrent_lru_cache(
+		std::size_t maxsize, Acquire ac, std::size_t nshards, lru_update_mode mode, weigher_type weigher)
+		: m_acquire(std::move(ac)), m_mode(mode), m_maxsize(maxsize)
+	{
+		if (maxsize == 0)
+			throw std::invalid_argument("concurrent_lru_cache: CacheMaxSize == 0 is invalid");
+
+		if (nshards == 0) nshards = default_shard_count;
+		m_shard_count = std::min(nshards, maxsize);
+		m_shards.reserve(m_shard_count);
+
+		for (std::size_t idx = 0; idx < m_shard_count; ++idx)
+		{
+			auto & sh = *m_shards.emplace_back(std::make_unique<shard>(shard_maxsize(maxsize, m_shard_count, idx), weigher));
+			if (m_mode == lru_update_mode::buffered)
+			{
+				sh.buffer.reserve(access_buffer_size);
+				sh.drain.reserve(access_buffer_size);
+			}
+		}
+	}
+}
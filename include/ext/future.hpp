@@ -28,6 +28,8 @@
 #include <ext/utility.hpp>
 #include <ext/intrusive_ptr.hpp>
 #include <ext/try_reserve.hpp>
+#include <ext/task_memory_resource.hpp> // for make_pmr_intrusive
+#include <ext/stop_token.hpp>           // for cooperative cancellation
 
 namespace ext
 {
@@ -167,8 +169,23 @@ namespace ext
 
 
 
+	/// kind of continuation_waiter objects, used by blocking future wait functions:
+	///  condvar - std::mutex + std::condition_variable, see continuation_waiter_impl;
+	///  futex   - atomic flag with short spin phase, then sleeping on futex. Cheaper for almost-ready futures.
+	///            Supported only on linux, on other platforms condvar waiters are used.
+	///            Opt-in: init_future_library(waiter_slots, waiter_kind::futex).
+	enum class waiter_kind : unsigned
+	{
+		condvar,
+		futex,
+	};
+
+	/// installs given waiters pool, returns false if current pool is in use
 	bool init_future_library(std::unique_ptr<continuation_waiters_pool> pool);
+	/// installs waiters pool of waiter_slots waiters, 0 - waiters are allocated on demand.
+	/// Waiters are of default kind - condvar.
 	bool init_future_library(unsigned waiter_slots = 0);
+	bool init_future_library(unsigned waiter_slots, waiter_kind kind);
 	void free_future_library();
 
 
@@ -191,6 +208,11 @@ namespace ext
 	auto async(ext::launch policy, Function && f, Args && ... args) ->
 	    future<std::invoke_result_t<std::decay_t<Function>, std::decay_t<Args>...>>;
 
+	/// same as async, but task is allocated from resource(see task_memory_resource), null - global heap
+	template<class Function, class ... Args>
+	auto async(std::allocator_arg_t, std::pmr::memory_resource * resource, ext::launch policy, Function && f, Args && ... args) ->
+	    future<std::invoke_result_t<std::decay_t<Function>, std::decay_t<Args>...>>;
+
 	template<class Function, class ... Args>
 	auto async(Function && f, Args && ... args) ->
 	    future<std::invoke_result_t<std::decay_t<Function>, std::decay_t<Args>...>>
@@ -232,6 +254,49 @@ namespace ext
 			ext::future<std::tuple<std::decay_t<Futures>...>>
 		>;
 
+	/// same as when_any/when_all, but on stop request all given futures are cancelled.
+	/// Already executing ones are not interrupted, but can observe same token themselves;
+	/// result becomes ready as usual - when any/all of futures are ready, including cancelled ones.
+	template <class InputIterator>
+	auto when_any(const ext::stop_token & token, InputIterator first, InputIterator last) ->
+		std::enable_if_t<
+			is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+			ext::future<when_any_result<std::vector<typename std::iterator_traits<InputIterator>::value_type>>>
+		>;
+
+	template <class ... Futures>
+	auto when_any(const ext::stop_token & token, Futures && ... futures) ->
+		std::enable_if_t<
+			is_future_types<std::decay_t<Futures>...>::value,
+			ext::future<when_any_result<std::tuple<std::decay_t<Futures>...>>>
+		>;
+
+	template <class InputIterator>
+	auto when_all(const ext::stop_token & token, InputIterator first, InputIterator last) ->
+		std::enable_if_t<
+			is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+			ext::future<std::vector<typename std::iterator_traits<InputIterator>::value_type>>
+		>;
+
+	template <class ... Futures>
+	auto when_all(const ext::stop_token & token, Futures && ... futures) ->
+		std::enable_if_t<
+			is_future_types<std::decay_t<Futures>...>::value,
+			ext::future<std::tuple<std::decay_t<Futures>...>>
+		>;
+
+	template <class Future>
+	class as_completed_range;
+
+	/// returns range of given futures, iterated in order of their completion:
+	/// dereferencing iterator waits until next future becomes ready.
+	template <class InputIterator>
+	auto as_completed(InputIterator first, InputIterator last) ->
+		std::enable_if_t<
+			is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+			ext::as_completed_range<typename std::iterator_traits<InputIterator>::value_type>
+		>;
+
 
 	template <class Future>
 	auto unwrap_future(Future f) ->
@@ -255,6 +320,26 @@ namespace ext
 	/// Multiple calls do not replace callback, but attach new one, so both will be called
 	template <class Type, class Functor>
 	void on_cancellation(ext::promise<Type> & promise, Functor functor);
+
+	/// Attaches stop callback functor to given future.
+	/// If stop is requested while future is not ready - functor is run from thread requesting stop,
+	/// if stop is already requested - immediately. Callback is unregistered as soon as future becomes ready,
+	/// waiting for concurrent run if any, so functor is not called after that.
+	template <class Future, class Functor>
+	auto on_stop(const Future & future, const ext::stop_token & token, Functor functor) ->
+		std::enable_if_t<is_future_type<Future>::value>;
+
+	/// Links future with stop token: if stop is requested while future is not ready - future is cancelled.
+	/// Task not yet started(thread_pool task, continuation, deferred task) is never executed then.
+	template <class Future>
+	auto cancel_on_stop(const Future & future, const ext::stop_token & token) ->
+		std::enable_if_t<is_future_type<Future>::value>;
+
+	/// Requests stop on source when given future is cancelled, so cancellation of parent future
+	/// propagates to all work linked with tokens of that source. If future is satisfied by other means - nothing happens
+	template <class Future>
+	auto request_stop_on_cancel(const Future & future, ext::stop_source source) ->
+		std::enable_if_t<is_future_type<Future>::value>;
 	
 	
 
@@ -314,6 +399,8 @@ namespace ext
 	//
 	// * when_(any/all)_task               - classes for implementing when_all/any functions
 	// * when_(any/all)_task_continuation  - classes for implementing when_all/any functions
+	// * when_(any/all)_bulk_task          - when_all/any for big future sets, continuations are allocated in one block
+	// * as_completed_task                 - shared state of as_completed range
 
 	class shared_state_basic;
 	template <class Type> class shared_state;
@@ -331,9 +418,62 @@ namespace ext
 
 	class when_any_task_continuation;
 	class when_all_task_continuation;
+	class when_bulk_continuation;
 
 	template <class> class when_any_task;
 	template <class> class when_all_task;
+	template <class> class when_any_bulk_task;
+	template <class> class when_all_bulk_task;
+	template <class> class as_completed_task;
+
+
+#ifdef EXT_FUTURE_TRACING
+	/// Optional instrumentation of shared states, compiled only if EXT_FUTURE_TRACING is defined(must be same for library and users).
+	/// Installed tracer is notified about lifetime events of every shared state, identified by shared_state_basic::trace_id.
+	/// Methods are called concurrently from any threads, and must not throw.
+	/// State passed to created is still under construction - only it's trace_id can be used.
+	/// See ext/future_tracing.hpp for recorder exporting events into chrome trace json.
+	class future_tracer
+	{
+	public:
+		/// shared state is created
+		virtual void created(const shared_state_basic * state) noexcept = 0;
+		/// promise of shared state is satisfied: with value, exception, cancellation, abandonment
+		virtual void satisfied(const shared_state_basic * state, future_state reason) noexcept = 0;
+		/// task(packaged_task, thread_pool/threaded_scheduler task, deferred task) starts/finishes execution,
+		/// continuation tasks(then) also report execution, nested into continuation run
+		virtual void execution_started(const shared_state_basic * state) noexcept = 0;
+		virtual void execution_finished(const shared_state_basic * state) noexcept = 0;
+		/// continuation is run by caller becoming ready
+		virtual void continuation_started(const shared_state_basic * caller, const shared_state_basic * continuation) noexcept = 0;
+		virtual void continuation_finished(const shared_state_basic * caller, const shared_state_basic * continuation) noexcept = 0;
+
+		virtual ~future_tracer() = default;
+	};
+
+	/// installs global tracer, nullptr - disables tracing. Tracer must outlive it's installation
+	void set_future_tracer(future_tracer * tracer) noexcept;
+	future_tracer * get_future_tracer() noexcept;
+
+	/// notifies installed tracer about task execution for lifetime of this object
+	class future_trace_execution_scope
+	{
+		const shared_state_basic * m_state;
+		future_tracer * m_tracer;
+
+	public:
+		future_trace_execution_scope(const shared_state_basic * state) noexcept
+			: m_state(state), m_tracer(get_future_tracer()) { if (m_tracer) m_tracer->execution_started(m_state); }
+		~future_trace_execution_scope() noexcept { if (m_tracer) m_tracer->execution_finished(m_state); }
+
+		future_trace_execution_scope(const future_trace_execution_scope &) = delete;
+		future_trace_execution_scope & operator =(const future_trace_execution_scope &) = delete;
+	};
+
+	#define EXT_FUTURE_TRACE_EXECUTION(state) ::ext::future_trace_execution_scope ext_future_trace_execution_scope_(state)
+#else
+	#define EXT_FUTURE_TRACE_EXECUTION(state) ((void)0)
+#endif
 
 
 
@@ -589,8 +729,9 @@ namespace ext
 		/// or cancellation request was made on this future.
 		///
 		/// Continuation is executed in the context of this future, immediately after result becomes available
+		/// resource, if not null, is used for allocating continuation task, see task_memory_resource
 		template <class Type, class Functor>
-		auto add_unique_continuation(Functor && continuation) ->
+		auto add_unique_continuation(Functor && continuation, std::pmr::memory_resource * resource = nullptr) ->
 		    ext::future<std::invoke_result_t<std::decay_t<Functor>, ext::future<Type>>>;
 
 		/// Continuation support, when future becomes fulfilled,
@@ -598,12 +739,25 @@ namespace ext
 		/// or cancellation request was made on this future.
 		///
 		/// Continuation is executed in the context of this future, immediately after result becomes available
+		/// resource, if not null, is used for allocating continuation task, see task_memory_resource
 		template <class Type, class Functor>
-		auto add_shared_continuation(Functor && continuation) ->
+		auto add_shared_continuation(Functor && continuation, std::pmr::memory_resource * resource = nullptr) ->
 		    ext::future<std::invoke_result_t<std::decay_t<Functor>, ext::shared_future<Type>>>;
 
+#ifdef EXT_FUTURE_TRACING
+	protected:
+		/// unique id of this shared state, see future_tracer
+		std::uint64_t m_trace_id;
+
+	public:
+		std::uint64_t trace_id() const noexcept { return m_trace_id; }
+
+	public:
+		shared_state_basic() noexcept;
+#else
 	public:
 		shared_state_basic() = default;
+#endif
 		virtual ~shared_state_basic() = default;
 
 		shared_state_basic(shared_state_basic &&) = delete;
@@ -1187,6 +1341,138 @@ namespace ext
 			: m_parent(std::move(parent)) {}
 	};
 
+	/// when_all/when_any/as_completed continuation for big future sets:
+	/// continuations for all futures are allocated by parent in one contiguous block.
+	/// Instead of deleting itself, releases it's parent reference, parent frees block when destroyed.
+	class when_bulk_continuation : public continuation_base
+	{
+		using base_type        = continuation_base;
+		using self_type        = when_bulk_continuation;
+		using parent_task_type = shared_state_basic;
+
+	protected:
+		parent_task_type * m_parent = nullptr;
+		std::size_t m_index = 0;
+
+	public:
+		void continuate(shared_state_basic * caller) noexcept override { m_parent->notify_satisfied(m_index); }
+		unsigned release() noexcept override;
+
+	public:
+		/// attaches this continuation to future state, notifying parent with given index.
+		/// returns false if future is already ready or deferred - in that case parent is notified immediately
+		bool attach(parent_task_type * parent, std::size_t index, shared_state_basic * handle) noexcept;
+	};
+
+	/// when_(all/any) over this number of futures are done via when_(all/any)_bulk_task
+	constexpr std::size_t when_bulk_threshold = 64;
+
+	/// attaches block of continuations to futures [first, last), when_any stops after first ready future
+	template <class Iterator>
+	void when_bulk_attach(shared_state_basic * parent, when_bulk_continuation * continuations, Iterator first, Iterator last, bool when_any) noexcept
+	{
+		for (std::size_t idx = 0; first != last; ++first, ++idx)
+		{
+			if (not continuations[idx].attach(parent, idx, first->handle().get()) and when_any)
+				break;
+		}
+	}
+
+	/// shared state returned by when_any call for big future sets.
+	template <class Type>
+	class when_any_bulk_task : public when_any_task<Type>
+	{
+		template <class InputIterator>
+		friend auto when_any(InputIterator first, InputIterator last) ->
+			std::enable_if_t<
+				is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+				ext::future<when_any_result<std::vector<typename std::iterator_traits<InputIterator>::value_type>>>
+			>;
+
+	private:
+		using base_type = when_any_task<Type>;
+		using self_type = when_any_bulk_task;
+
+	protected:
+		std::unique_ptr<when_bulk_continuation[]> m_continuations;
+
+	public:
+		when_any_bulk_task(Type && val, std::size_t count)
+			: base_type(std::move(val)), m_continuations(std::make_unique<when_bulk_continuation[]>(count)) {}
+	};
+
+	/// shared state returned by when_all call for big future sets.
+	/// Instead of single counter, decremented by every future, futures are counted by shards of shard_size,
+	/// and only completed shards decrement when_all_task counter: completing futures mostly do not contend with each other.
+	template <class Type>
+	class when_all_bulk_task : public when_all_task<Type>
+	{
+		template <class InputIterator>
+		friend auto when_all(InputIterator first, InputIterator last) ->
+			std::enable_if_t<
+				is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+				ext::future<std::vector<typename std::iterator_traits<InputIterator>::value_type>>
+			>;
+
+	private:
+		using base_type = when_all_task<Type>;
+		using self_type = when_all_bulk_task;
+
+		static constexpr std::size_t shard_size = 64;
+		static constexpr std::size_t cacheline_size = 64;
+
+		struct alignas(cacheline_size) shard
+		{
+			std::atomic_size_t count;
+		};
+
+	protected:
+		std::unique_ptr<shard[]> m_shards;
+		std::unique_ptr<when_bulk_continuation[]> m_continuations;
+
+	public:
+		void notify_satisfied(std::size_t index) noexcept override;
+
+	public:
+		when_all_bulk_task(Type && val, std::size_t count);
+	};
+
+	/// shared state of as_completed range: remembers order in which futures became ready.
+	/// Becomes ready itself, when all futures are ready.
+	template <class Future>
+	class as_completed_task : public shared_state_unexceptional<void>
+	{
+		template <class> friend class as_completed_range;
+
+		template <class InputIterator>
+		friend auto as_completed(InputIterator first, InputIterator last) ->
+			std::enable_if_t<
+				is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+				ext::as_completed_range<typename std::iterator_traits<InputIterator>::value_type>
+			>;
+
+	private:
+		using base_type = shared_state_unexceptional<void>;
+		using self_type = as_completed_task;
+
+	protected:
+		std::vector<Future> m_futures;
+		std::unique_ptr<when_bulk_continuation[]> m_continuations;
+
+		std::mutex m_mutex;
+		std::condition_variable m_var;
+		/// indexes of ready futures in order of completion, reserved for all futures
+		std::vector<std::size_t> m_completed;
+
+	public:
+		void notify_satisfied(std::size_t index) noexcept override;
+		/// waits until at least pos + 1 futures are ready, returns index of pos-th completed future
+		std::size_t wait_completed(std::size_t pos);
+
+	public:
+		as_completed_task(std::vector<Future> futures);
+	};
+
 
 	/// unwrap_future continuation for implementing unwrap functionality.
 	class unwrap_continuation : public ext::continuation_base
@@ -1253,6 +1539,31 @@ namespace ext
 		    : m_functor(std::move(functor)) {}
 	};
 
+	/// continuation linking pending shared state with stop token:
+	/// while state is not ready - it's registered as stop callback, on stop request functor is invoked.
+	/// When state becomes ready - callback is unregistered, waiting for concurrent invocation if any,
+	/// so functor is never invoked after continuate has returned.
+	template <class Functor>
+	class stop_continuation : public continuation_base, private stop_callback_base
+	{
+		Functor m_functor;
+
+	private:
+		void invoke() noexcept override;
+
+	public:
+		virtual void continuate(shared_state_basic * caller) noexcept override { detach(); }
+		/// registers for token, attaches to state. Stop callback is registered first:
+		/// stop request and state satisfaction can race, but registration is always dropped by continuate
+		void link(shared_state_basic * state, const ext::stop_token & token) noexcept;
+
+	public:
+		stop_continuation(Functor && functor)
+		    : m_functor(std::move(functor)) {}
+
+		~stop_continuation() noexcept { detach(); }
+	};
+
 
 	/// abstract continuation_waiters_pool used to retrieve continuation waiters
 	class continuation_waiters_pool
@@ -1364,7 +1675,7 @@ namespace ext
 	}
 
 	template <class Type, class Functor>
-	auto shared_state_basic::add_unique_continuation(Functor && continuation) ->
+	auto shared_state_basic::add_unique_continuation(Functor && continuation, std::pmr::memory_resource * resource) ->
 	    ext::future<std::invoke_result_t<std::decay_t<Functor>, ext::future<Type>>>
 	{
 	    using return_type = std::invoke_result_t<std::decay_t<Functor>, ext::future<Type>>;
@@ -1380,14 +1691,14 @@ namespace ext
 		if (is_deferred()) wait();
 
 	    using ct_type = continuation_task<decltype(wrapped), return_type>;
-		state = make_intrusive<ct_type>(std::move(wrapped));
+		state = make_pmr_intrusive<ct_type>(resource, std::move(wrapped));
 
 		add_continuation(state.get());
 		return {state};
 	}
 
 	template <class Type, class Functor>
-	auto shared_state_basic::add_shared_continuation(Functor && continuation) ->
+	auto shared_state_basic::add_shared_continuation(Functor && continuation, std::pmr::memory_resource * resource) ->
 	    ext::future<std::invoke_result_t<std::decay_t<Functor>, ext::shared_future<Type>>>
 	{
 	    using return_type = std::invoke_result_t<std::decay_t<Functor>, ext::shared_future<Type>>;
@@ -1403,7 +1714,7 @@ namespace ext
 		if (is_deferred()) wait();
 
 	    using ct_type = continuation_task<decltype(wrapped), return_type>;
-		state = make_intrusive<ct_type>(std::move(wrapped));
+		state = make_pmr_intrusive<ct_type>(resource, std::move(wrapped));
 
 		add_continuation(state.get());
 		return {state};
@@ -1804,6 +2115,7 @@ namespace ext
 		if (not this->mark_marked())
 			return;
 
+		EXT_FUTURE_TRACE_EXECUTION(this);
 		try
 		{
 			shared_state_execute(*this, m_functor, std::move(args)...);
@@ -1820,6 +2132,7 @@ namespace ext
 		if (not this->mark_marked())
 			return;
 
+		EXT_FUTURE_TRACE_EXECUTION(this);
 		try
 		{
 			shared_state_execute(*this, std::move(m_functor), std::move(args)...);
@@ -1836,6 +2149,7 @@ namespace ext
 		if (not ext::unconst(this)->mark_marked())
 			return base_type::wait();
 
+		EXT_FUTURE_TRACE_EXECUTION(this);
 		try
 		{
 			shared_state_execute(*ext::unconst(this), std::move(ext::unconst(this)->m_functor));
@@ -1868,6 +2182,7 @@ namespace ext
 		if (not ext::unconst(this)->mark_marked())
 			return base_type::wait();
 
+		EXT_FUTURE_TRACE_EXECUTION(this);
 		try
 		{
 			auto self = ext::unconst(this);
@@ -1900,6 +2215,60 @@ namespace ext
 		}
 	}
 
+	template <class Type>
+	when_all_bulk_task<Type>::when_all_bulk_task(Type && val, std::size_t count)
+		: base_type(std::move(val), (count + shard_size - 1) / shard_size),
+		  m_shards(std::make_unique<shard[]>((count + shard_size - 1) / shard_size)),
+		  m_continuations(std::make_unique<when_bulk_continuation[]>(count))
+	{
+		for (std::size_t idx = 0; count; ++idx)
+		{
+			auto n = std::min(count, shard_size);
+			m_shards[idx].count.store(n, std::memory_order_relaxed);
+			count -= n;
+		}
+	}
+
+	template <class Type>
+	void when_all_bulk_task<Type>::notify_satisfied(std::size_t index) noexcept
+	{
+		auto prev_count = m_shards[index / shard_size].count.fetch_sub(1, std::memory_order_relaxed);
+		if (prev_count == 1) base_type::notify_satisfied(index);
+	}
+
+	template <class Future>
+	as_completed_task<Future>::as_completed_task(std::vector<Future> futures)
+		: m_futures(std::move(futures)), m_continuations(std::make_unique<when_bulk_continuation[]>(m_futures.size()))
+	{
+		m_completed.reserve(m_futures.size());
+	}
+
+	template <class Future>
+	void as_completed_task<Future>::notify_satisfied(std::size_t index) noexcept
+	{
+		bool last;
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+			// can't throw - reserved in constructor
+			m_completed.push_back(index);
+			last = m_completed.size() == m_futures.size();
+		}
+
+		// waiters wait for different positions, every one should recheck it's own
+		m_var.notify_all();
+		if (last and satisfy_promise(future_state::value))
+			set_future_ready();
+	}
+
+	template <class Future>
+	std::size_t as_completed_task<Future>::wait_completed(std::size_t pos)
+	{
+		assert(pos < m_futures.size());
+		std::unique_lock<std::mutex> lk(m_mutex);
+		m_var.wait(lk, [this, pos] { return pos < m_completed.size(); });
+		return m_completed[pos];
+	}
+
 	template <class Functor>
 	void cancellation_continuation<Functor>::continuate(shared_state_basic * caller) noexcept
 	{
@@ -1907,6 +2276,22 @@ namespace ext
 			m_functor();
 	}
 
+	template <class Functor>
+	void stop_continuation<Functor>::invoke() noexcept
+	{
+		// functor can make linked state ready, which runs continuate and releases this continuation,
+		// keep it alive until functor returns. Invoke happens only while registered, so reference is still held by state
+		ext::intrusive_ptr<shared_state_basic> self(this);
+		m_functor();
+	}
+
+	template <class Functor>
+	void stop_continuation<Functor>::link(shared_state_basic * state, const ext::stop_token & token) noexcept
+	{
+		attach(token);
+		state->add_continuation(this);
+	}
+
 	/************************************************************************/
 	/*                    front-end classes                                 */
 	/************************************************************************/
@@ -1954,6 +2339,38 @@ namespace ext
 			return self.m_ptr->template add_unique_continuation<value_type>(std::forward<Functor>(continuation));
 		}
 
+		/// same as then, but continuation task is allocated from resource(see task_memory_resource), null - global heap
+		template <class Functor>
+		auto then(std::allocator_arg_t, std::pmr::memory_resource * resource, Functor && continuation) ->
+			ext::future<std::invoke_result_t<std::decay_t<Functor>, ext::future<value_type>>>
+		{
+			assert(valid());
+			auto self = std::move(*this);
+			return self.m_ptr->template add_unique_continuation<value_type>(std::forward<Functor>(continuation), resource);
+		}
+
+		/// same as then, but continuation is posted to executor, instead of running in context of thread satisfying this future.
+		/// Executor is any type with thread_pool-like method submit(future, func) -> ext::future, for example ext::thread_pool.
+		/// If this future is already ready - continuation is submitted immediately
+		template <class Executor, class Functor>
+		auto then(Executor & executor, Functor && continuation) ->
+			decltype(executor.submit(std::declval<future>(), std::forward<Functor>(continuation)))
+		{
+			assert(valid());
+			return executor.submit(std::move(*this), std::forward<Functor>(continuation));
+		}
+
+		/// same as then, but continuation is linked with stop token, see ext::cancel_on_stop:
+		/// if stop is requested before continuation is started - it's cancelled and never executed
+		template <class Functor>
+		auto then(const ext::stop_token & token, Functor && continuation) ->
+			ext::future<std::invoke_result_t<std::decay_t<Functor>, ext::future<value_type>>>
+		{
+			auto result = then(std::forward<Functor>(continuation));
+			ext::cancel_on_stop(result, token);
+			return result;
+		}
+
 	public:
 		future() = default;
 		future(intrusive_ptr ptr) noexcept : m_ptr(std::move(ptr)) {}
@@ -2010,6 +2427,34 @@ namespace ext
 			return m_ptr->template add_shared_continuation<value_type>(std::forward<Functor>(continuation));
 		}
 
+		/// same as then, but continuation task is allocated from resource(see task_memory_resource), null - global heap
+		template <class Functor>
+		auto then(std::allocator_arg_t, std::pmr::memory_resource * resource, Functor && continuation) ->
+			ext::future<std::invoke_result_t<std::decay_t<Functor>, ext::shared_future<value_type>>>
+		{
+			assert(valid());
+			return m_ptr->template add_shared_continuation<value_type>(std::forward<Functor>(continuation), resource);
+		}
+
+		/// same as then, but continuation is posted to executor, see future::then(executor, continuation)
+		template <class Executor, class Functor>
+		auto then(Executor & executor, Functor && continuation) ->
+			decltype(executor.submit(std::declval<shared_future>(), std::forward<Functor>(continuation)))
+		{
+			assert(valid());
+			return executor.submit(*this, std::forward<Functor>(continuation));
+		}
+
+		/// same as then, but continuation is linked with stop token, see future::then(token, continuation)
+		template <class Functor>
+		auto then(const ext::stop_token & token, Functor && continuation) ->
+			ext::future<std::invoke_result_t<std::decay_t<Functor>, ext::shared_future<value_type>>>
+		{
+			auto result = then(std::forward<Functor>(continuation));
+			ext::cancel_on_stop(result, token);
+			return result;
+		}
+
 	public:
 		shared_future() = default;
 		// shared_future can only be constructed by moving future
@@ -2071,6 +2516,8 @@ namespace ext
 
 	public:
 		promise() noexcept : m_ptr(ext::make_intrusive<ext::shared_state<value_type>>()) {}
+		/// shared state is allocated from resource(see task_memory_resource), null - global heap
+		promise(std::allocator_arg_t, std::pmr::memory_resource * resource) : m_ptr(ext::make_pmr_intrusive<ext::shared_state<value_type>>(resource)) {}
 		promise(intrusive_ptr ptr) noexcept : m_ptr(std::move(ptr)) {}
 		~promise() noexcept { if (m_ptr) m_ptr->release_promise(); }
 
@@ -2170,6 +2617,8 @@ namespace ext
 
 	public:
 		promise() : m_ptr(ext::make_intrusive<ext::shared_state<value_type &>>()) {}
+		/// shared state is allocated from resource(see task_memory_resource), null - global heap
+		promise(std::allocator_arg_t, std::pmr::memory_resource * resource) : m_ptr(ext::make_pmr_intrusive<ext::shared_state<value_type &>>(resource)) {}
 		promise(intrusive_ptr ptr) noexcept : m_ptr(std::move(ptr)) {}
 		~promise() noexcept { if (m_ptr) m_ptr->release_promise(); }
 
@@ -2260,6 +2709,8 @@ namespace ext
 
 	public:
 		promise() noexcept : m_ptr(ext::make_intrusive<ext::shared_state<value_type>>()) {}
+		/// shared state is allocated from resource(see task_memory_resource), null - global heap
+		promise(std::allocator_arg_t, std::pmr::memory_resource * resource) : m_ptr(ext::make_pmr_intrusive<ext::shared_state<value_type>>(resource)) {}
 		promise(intrusive_ptr ptr) noexcept : m_ptr(std::move(ptr)) {}
 		~promise() noexcept { if (m_ptr) m_ptr->release_promise(); }
 
@@ -2431,7 +2882,14 @@ namespace ext
 	
 
 	template<class Function, class... Args>
-	auto async(ext::launch policy, Function && func, Args && ... args) ->
+	inline auto async(ext::launch policy, Function && func, Args && ... args) ->
+	    future<std::invoke_result_t<std::decay_t<Function>, std::decay_t<Args>...>>
+	{
+		return async(std::allocator_arg, nullptr, policy, std::forward<Function>(func), std::forward<Args>(args)...);
+	}
+
+	template<class Function, class... Args>
+	auto async(std::allocator_arg_t, std::pmr::memory_resource * resource, ext::launch policy, Function && func, Args && ... args) ->
 	    future<std::invoke_result_t<std::decay_t<Function>, std::decay_t<Args>...>>
 	{
 	    using result_type = std::invoke_result_t<std::decay_t<Function>, std::decay_t<Args>...>;
@@ -2444,7 +2902,7 @@ namespace ext
 
 		if (static_cast<unsigned>(policy) & static_cast<unsigned>(ext::launch::async))
 		{
-			auto task = ext::make_intrusive<packaged_once_task_impl<decltype(closure), result_type()>>(std::move(closure));
+			auto task = ext::make_pmr_intrusive<packaged_once_task_impl<decltype(closure), result_type()>>(resource, std::move(closure));
 			std::thread thx([task] { task->execute(); });
 			thx.detach();
 
@@ -2452,7 +2910,7 @@ namespace ext
 		}
 		else //if (static_cast<unsigned>(policy) & static_cast<unsigned>(ext::launch::deferred))
 		{
-			auto task = ext::make_intrusive<deferred_once_task_impl<decltype(closure), result_type()>>(std::move(closure));
+			auto task = ext::make_pmr_intrusive<deferred_once_task_impl<decltype(closure), result_type()>>(resource, std::move(closure));
 			return ext::future<result_type>(std::move(task));
 		}
 	}
@@ -2480,6 +2938,16 @@ namespace ext
 		if (futures.empty())
 			return make_ready_future<result_type>(std::move(result));
 
+		if (futures.size() >= when_bulk_threshold)
+		{
+			using bulk_state_type = when_any_bulk_task<result_type>;
+			auto count = futures.size();
+			auto state = ext::make_intrusive<bulk_state_type>(std::move(result), count);
+			auto & futs = state->m_val.futures;
+			when_bulk_attach(state.get(), state->m_continuations.get(), futs.begin(), futs.end(), true);
+			return {std::move(state)};
+		}
+
 		std::size_t idx = 0;
 		auto state = ext::make_intrusive<state_type>(std::move(result));
 		for (const auto & f : state->m_val.futures)
@@ -2551,6 +3019,16 @@ namespace ext
 		if (futures.empty())
 			return make_ready_future<result_type>(std::move(futures));
 
+		if (futures.size() >= when_bulk_threshold)
+		{
+			using bulk_state_type = when_all_bulk_task<result_type>;
+			auto count = futures.size();
+			auto state = ext::make_intrusive<bulk_state_type>(std::move(futures), count);
+			auto & futs = state->m_val;
+			when_bulk_attach(state.get(), state->m_continuations.get(), futs.begin(), futs.end(), false);
+			return {std::move(state)};
+		}
+
 		auto state = ext::make_intrusive<state_type>(std::move(futures), futures.size());
 		for (const auto & f : state->m_val)
 		{
@@ -2595,6 +3073,93 @@ namespace ext
 	}
 
 
+	/// range returned by as_completed: yields futures in order of their completion.
+	/// Iterators are input iterators, dereferencing waits until next future becomes ready,
+	/// range can be iterated only once. Futures not yet ready are kept alive even if range is destroyed.
+	template <class Future>
+	class as_completed_range
+	{
+		using self_type  = as_completed_range;
+		using state_type = as_completed_task<Future>;
+
+	public:
+		class iterator;
+		using value_type = Future;
+
+	private:
+		ext::intrusive_ptr<state_type> m_state;
+
+	public:
+		std::size_t size() const noexcept { return m_state ? m_state->m_futures.size() : 0; }
+		bool empty()       const noexcept { return size() == 0; }
+
+		/// waits until pos + 1 futures are ready, returns pos-th completed future
+		Future & wait_completed(std::size_t pos) { return m_state->m_futures[m_state->wait_completed(pos)]; }
+		/// future becoming ready when all futures of range are ready
+		ext::future<void> all() const { return m_state ? ext::future<void>(m_state) : ext::make_ready_future(); }
+
+		iterator begin() noexcept { return {this, 0}; }
+		iterator end()   noexcept { return {this, size()}; }
+
+	public:
+		as_completed_range() = default;
+		as_completed_range(ext::intrusive_ptr<state_type> state) noexcept : m_state(std::move(state)) {}
+	};
+
+	template <class Future>
+	class as_completed_range<Future>::iterator
+	{
+		as_completed_range * m_range = nullptr;
+		std::size_t m_pos = 0;
+
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type        = Future;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = Future *;
+		using reference         = Future &;
+
+	public:
+		reference operator *() const { return m_range->wait_completed(m_pos); }
+		pointer  operator ->() const { return &**this; }
+
+		iterator & operator ++() noexcept { ++m_pos; return *this; }
+		iterator operator ++(int) noexcept { auto tmp = *this; ++m_pos; return tmp; }
+
+		bool operator ==(const iterator & other) const noexcept { return m_pos == other.m_pos; }
+		bool operator !=(const iterator & other) const noexcept { return m_pos != other.m_pos; }
+
+	public:
+		iterator() = default;
+		iterator(as_completed_range * range, std::size_t pos) noexcept : m_range(range), m_pos(pos) {}
+	};
+
+	template <class InputIterator>
+	auto as_completed(InputIterator first, InputIterator last) ->
+		std::enable_if_t<
+			is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+			ext::as_completed_range<typename std::iterator_traits<InputIterator>::value_type>
+		>
+	{
+	    using value_type  = typename std::iterator_traits<InputIterator>::value_type;
+	    using state_type  = as_completed_task<value_type>;
+
+		std::vector<value_type> futures;
+		ext::try_reserve(futures, first, last);
+
+		for (; first != last; ++first)
+			futures.push_back(*first);
+
+		if (futures.empty())
+			return {};
+
+		auto state = ext::make_intrusive<state_type>(std::move(futures));
+		auto & futs = state->m_futures;
+		when_bulk_attach(state.get(), state->m_continuations.get(), futs.begin(), futs.end(), false);
+		return {std::move(state)};
+	}
+
+
 	template <class Future>
 	inline auto unwrap_future(Future f) ->
 		std::enable_if_t<
@@ -2628,6 +3193,134 @@ namespace ext
 		promise.handle()->add_continuation(cont.get());
 	}
 
+	template <class Future, class Functor>
+	auto on_stop(const Future & future, const ext::stop_token & token, Functor functor) ->
+		std::enable_if_t<is_future_type<Future>::value>
+	{
+		using return_type = std::invoke_result_t<Functor>;
+		static_assert(std::is_same_v<return_type, void>);
+
+		assert(future.valid());
+		if (not token.stop_possible() or future.is_ready())
+			return;
+
+		using continuation_type = stop_continuation<Functor>;
+		auto cont = ext::make_intrusive<continuation_type>(std::move(functor));
+		cont->link(future.handle().get(), token);
+	}
+
+	template <class Future>
+	auto cancel_on_stop(const Future & future, const ext::stop_token & token) ->
+		std::enable_if_t<is_future_type<Future>::value>
+	{
+		// raw pointer is enough: callback is unregistered before state is released by it's continuation chain
+		ext::on_stop(future, token, [state = future.handle().get()] { state->cancel(); });
+	}
+
+	template <class Future>
+	auto request_stop_on_cancel(const Future & future, ext::stop_source source) ->
+		std::enable_if_t<is_future_type<Future>::value>
+	{
+		assert(future.valid());
+		auto functor = [source = std::move(source)]() mutable { source.request_stop(); };
+
+		using continuation_type = cancellation_continuation<decltype(functor)>;
+		auto cont = ext::make_intrusive<continuation_type>(std::move(functor));
+		future.handle()->add_continuation(cont.get());
+	}
+
+	/// stop callback of when_any/when_all with stop token: cancels all input futures
+	class when_stop_canceller
+	{
+		std::vector<ext::intrusive_ptr<shared_state_basic>> m_states;
+
+	public:
+		void operator()() const noexcept
+		{
+			for (auto & state : m_states)
+				state->cancel();
+		}
+
+	public:
+		when_stop_canceller(std::vector<ext::intrusive_ptr<shared_state_basic>> states) noexcept
+			: m_states(std::move(states)) {}
+	};
+
+	template <class InputIterator>
+	auto when_any(const ext::stop_token & token, InputIterator first, InputIterator last) ->
+		std::enable_if_t<
+			is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+			ext::future<when_any_result<std::vector<typename std::iterator_traits<InputIterator>::value_type>>>
+		>
+	{
+		using value_type = typename std::iterator_traits<InputIterator>::value_type;
+
+		// input iterator is single pass: take futures first, than collect their states
+		std::vector<value_type> futures;
+		ext::try_reserve(futures, first, last);
+		for (; first != last; ++first)
+			futures.push_back(*first);
+
+		std::vector<ext::intrusive_ptr<shared_state_basic>> states;
+		states.reserve(futures.size());
+		for (auto & f : futures)
+			states.push_back(f.handle());
+
+		auto result = ext::when_any(std::make_move_iterator(futures.begin()), std::make_move_iterator(futures.end()));
+		ext::on_stop(result, token, when_stop_canceller(std::move(states)));
+		return result;
+	}
+
+	template <class ... Futures>
+	auto when_any(const ext::stop_token & token, Futures && ... futures) ->
+		std::enable_if_t<
+			is_future_types<std::decay_t<Futures>...>::value,
+			ext::future<when_any_result<std::tuple<std::decay_t<Futures>...>>>
+		>
+	{
+		std::vector<ext::intrusive_ptr<shared_state_basic>> states = {futures.handle()...};
+		auto result = ext::when_any(std::forward<Futures>(futures)...);
+		ext::on_stop(result, token, when_stop_canceller(std::move(states)));
+		return result;
+	}
+
+	template <class InputIterator>
+	auto when_all(const ext::stop_token & token, InputIterator first, InputIterator last) ->
+		std::enable_if_t<
+			is_future_type<typename std::iterator_traits<InputIterator>::value_type>::value,
+			ext::future<std::vector<typename std::iterator_traits<InputIterator>::value_type>>
+		>
+	{
+		using value_type = typename std::iterator_traits<InputIterator>::value_type;
+
+		std::vector<value_type> futures;
+		ext::try_reserve(futures, first, last);
+		for (; first != last; ++first)
+			futures.push_back(*first);
+
+		std::vector<ext::intrusive_ptr<shared_state_basic>> states;
+		states.reserve(futures.size());
+		for (auto & f : futures)
+			states.push_back(f.handle());
+
+		auto result = ext::when_all(std::make_move_iterator(futures.begin()), std::make_move_iterator(futures.end()));
+		ext::on_stop(result, token, when_stop_canceller(std::move(states)));
+		return result;
+	}
+
+	template <class ... Futures>
+	auto when_all(const ext::stop_token & token, Futures && ... futures) ->
+		std::enable_if_t<
+			is_future_types<std::decay_t<Futures>...>::value,
+			ext::future<std::tuple<std::decay_t<Futures>...>>
+		>
+	{
+		std::vector<ext::intrusive_ptr<shared_state_basic>> states = {futures.handle()...};
+		auto result = ext::when_all(std::forward<Futures>(futures)...);
+		ext::on_stop(result, token, when_stop_canceller(std::move(states)));
+		return result;
+	}
+
 	/************************************************************************/
 	/*                   swap non member functions                          */
 	/************************************************************************/
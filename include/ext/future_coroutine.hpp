@@ -0,0 +1,243 @@
+#pragma once
+// C++20 coroutine support for ext::future/ext::shared_future:
+// * ext::future<Type> can be used as coroutine return type;
+// * ext::future<Type>(rvalue) and ext::shared_future<Type> can be co_await'ed.
+//
+// Coroutine returning ext::future<Type> is it's own shared state:
+// promise_type is a shared_state<Type> placed in coroutine frame, returned future references it,
+// frame is destroyed when last reference is released. When such coroutine co_await's ext future,
+// frame itself is attached to awaited future as continuation(see shared_state_basic::add_continuation) - no allocations and no blocking.
+// Other coroutine types can co_await ext futures too, but small continuation object is allocated per co_await.
+
+#if not defined(__cpp_impl_coroutine) or not __has_include(<coroutine>)
+#error "ext/future_coroutine.hpp requires C++20 coroutines support"
+#endif
+
+#include <coroutine>
+#include <ext/future.hpp>
+
+namespace ext
+{
+	/// base of co_await'ers of ext::future/ext::shared_future: ready check and result retrieval
+	template <class Future>
+	class future_awaiter_base
+	{
+	protected:
+		Future m_future;
+
+	public:
+		bool await_ready()
+		{
+			// deferred future is executed right here, like wait does
+			if (m_future.is_deferred()) m_future.wait();
+			return m_future.is_ready();
+		}
+
+		decltype(auto) await_resume() { return m_future.get(); }
+
+	public:
+		future_awaiter_base(Future future) noexcept : m_future(std::move(future)) {}
+	};
+
+	/// co_await'er for any coroutine type: allocates continuation resuming coroutine
+	template <class Future>
+	class future_awaiter : public future_awaiter_base<Future>
+	{
+		class continuation : public continuation_base
+		{
+		public:
+			std::coroutine_handle<> m_handle;
+			/// resume race flag: whoever comes second - continuate or await_suspend, resumes coroutine
+			std::atomic_bool m_resume = ATOMIC_VAR_INIT(false);
+
+		public:
+			void continuate(shared_state_basic * caller) noexcept override
+			{
+				if (m_resume.exchange(true, std::memory_order_acq_rel))
+					m_handle.resume();
+			}
+
+		public:
+			continuation(std::coroutine_handle<> handle) noexcept : m_handle(handle) {}
+		};
+
+	public:
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			auto cont = ext::make_intrusive<continuation>(handle);
+			this->m_future.handle()->add_continuation(cont.get());
+			// if continuation already fired(concurrently or immediately) - do not suspend
+			return not cont->m_resume.exchange(true, std::memory_order_acq_rel);
+		}
+
+	public:
+		using future_awaiter_base<Future>::future_awaiter_base;
+	};
+
+	template <class Type>
+	inline auto operator co_await(ext::future<Type> && future) -> future_awaiter<ext::future<Type>>
+	{
+		assert(future.valid());
+		return {std::move(future)};
+	}
+
+	template <class Type>
+	inline auto operator co_await(const ext::shared_future<Type> & future) -> future_awaiter<ext::shared_future<Type>>
+	{
+		assert(future.valid());
+		return {future};
+	}
+
+	/// promise_type of coroutine returning ext::future<Type>, lives in coroutine frame.
+	/// Like unwrap_continuation it's both shared_state and continuation:
+	/// own continuations(those waiting on returned future) are kept in m_task_next,
+	/// while m_fstnext is used as link in continuation chain of currently awaited future.
+	///
+	/// Cancelling returned future does not interrupt coroutine, it's result is just discarded.
+	template <class Type>
+	class coroutine_state_base : public shared_state<Type>
+	{
+		using base_type = shared_state<Type>;
+
+		template <class Future>
+		class frame_awaiter : public future_awaiter_base<Future>
+		{
+			coroutine_state_base * m_state;
+
+		public:
+			bool await_suspend(std::coroutine_handle<>) noexcept { return m_state->suspend_on(*this->m_future.handle()); }
+
+		public:
+			frame_awaiter(coroutine_state_base * state, Future future) noexcept
+				: future_awaiter_base<Future>(std::move(future)), m_state(state) {}
+		};
+
+		class final_awaiter
+		{
+			coroutine_state_base * m_state;
+
+		public:
+			bool await_ready() const noexcept { return false; }
+			// coroutine releases it's reference, if future is already released - frame is destroyed right here
+			void await_suspend(std::coroutine_handle<>) noexcept { m_state->release(); }
+			void await_resume() const noexcept {}
+
+		public:
+			final_awaiter(coroutine_state_base * state) noexcept : m_state(state) {}
+		};
+
+	protected:
+		using base_type::fsnext_init;
+		using base_type::m_fstnext;
+
+		/// continuation chain of this shared state, see unwrap_continuation
+		std::atomic_uintptr_t m_task_next = ATOMIC_VAR_INIT(fsnext_init);
+		/// resume race flag, see future_awaiter::continuation
+		std::atomic_bool m_resume = ATOMIC_VAR_INIT(false);
+		std::coroutine_handle<> m_handle;
+
+	protected:
+		/// attaches frame as continuation to awaited state, returns true if coroutine should be suspended
+		bool suspend_on(shared_state_basic & awaited) noexcept;
+
+	public:
+		void set_future_ready() noexcept override
+		{ shared_state_basic::run_continuations(shared_state_basic::signal_future(m_task_next), this); }
+
+		bool add_continuation(shared_state_basic * continuation) noexcept override
+		{ return shared_state_basic::attach_continuation(m_task_next, continuation, this); }
+
+		auto acquire_waiter() -> continuation_waiter * override
+		{ return shared_state_basic::acquire_waiter(m_task_next); }
+
+		void release_waiter(continuation_waiter * waiter) noexcept override
+		{ return shared_state_basic::release_waiter(m_task_next, waiter); }
+
+		void continuate(shared_state_basic * caller) noexcept override
+		{
+			if (m_resume.exchange(true, std::memory_order_acq_rel))
+				m_handle.resume();
+		}
+
+		/// instead of deleting itself - destroys coroutine frame
+		unsigned release() noexcept override;
+
+	public:
+		auto initial_suspend() const noexcept { return std::suspend_never(); }
+		auto final_suspend() noexcept { return final_awaiter(this); }
+		void unhandled_exception() { this->set_exception(std::current_exception()); }
+
+		template <class Awaitable>
+		decltype(auto) await_transform(Awaitable && awaitable) noexcept { return std::forward<Awaitable>(awaitable); }
+
+		template <class Other>
+		auto await_transform(ext::future<Other> && future) noexcept -> frame_awaiter<ext::future<Other>>
+		{ assert(future.valid()); return {this, std::move(future)}; }
+
+		template <class Other>
+		auto await_transform(const ext::shared_future<Other> & future) noexcept -> frame_awaiter<ext::shared_future<Other>>
+		{ assert(future.valid()); return {this, future}; }
+	};
+
+	template <class Type>
+	bool coroutine_state_base<Type>::suspend_on(shared_state_basic & awaited) noexcept
+	{
+		// only one co_await at a time, no concurrency here:
+		// previous continuate call already read m_fstnext
+		m_resume.store(false, std::memory_order_relaxed);
+		m_fstnext.store(fsnext_init, std::memory_order_relaxed);
+
+		awaited.add_continuation(this);
+		return not m_resume.exchange(true, std::memory_order_acq_rel);
+	}
+
+	template <class Type>
+	unsigned coroutine_state_base<Type>::release() noexcept
+	{
+		auto ref = this->m_refs.fetch_sub(1, std::memory_order_release);
+		if (ref == 1)
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			// coroutine is suspended at final suspend point, or was never resumed after awaited future was dropped
+			m_handle.destroy();
+		}
+
+		return --ref;
+	}
+
+	template <class Type>
+	class coroutine_state : public coroutine_state_base<Type>
+	{
+	public:
+		template <class Value>
+		void return_value(Value && val) { this->set_value(std::forward<Value>(val)); }
+
+		ext::future<Type> get_return_object()
+		{
+			this->m_handle = std::coroutine_handle<coroutine_state>::from_promise(*this);
+			this->mark_retrived();
+			// refcount: 1 for coroutine itself, released on final suspend, 1 for future
+			return {ext::intrusive_ptr<shared_state_basic>(this)};
+		}
+	};
+
+	template <>
+	class coroutine_state<void> : public coroutine_state_base<void>
+	{
+	public:
+		void return_void() { this->set_value(); }
+
+		ext::future<void> get_return_object()
+		{
+			this->m_handle = std::coroutine_handle<coroutine_state>::from_promise(*this);
+			this->mark_retrived();
+			return {ext::intrusive_ptr<shared_state_basic>(this)};
+		}
+	};
+}
+
+template <class Type, class ... Args>
+struct std::coroutine_traits<ext::future<Type>, Args...>
+{
+	using promise_type = ext::coroutine_state<Type>;
+};
@@ -0,0 +1,88 @@
+#pragma once
+// Recorder of future_tracer events, exporting them into Chrome trace event json format,
+// which can be opened by chrome://tracing or https://ui.perfetto.dev.
+//
+// Requires EXT_FUTURE_TRACING to be defined for both library and user code, see ext::future_tracer.
+//
+// Exported trace:
+// * task executions(thread_pool, threaded_scheduler, packaged and deferred tasks) and continuation runs - are slices,
+//   named by shared state type, on thread where they were executed;
+// * creation and satisfaction of shared states - are instant events;
+// * flows connect creation of task with it's execution, and satisfaction of future with run of it's continuations -
+//   following them gives critical path of request through thread_pool, threaded_scheduler, when_all, etc.
+
+#if not defined(EXT_FUTURE_TRACING)
+#error "ext/future_tracing.hpp requires EXT_FUTURE_TRACING to be defined"
+#endif
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include <typeinfo>
+#include <ext/future.hpp>
+
+namespace ext
+{
+	/// future_tracer recording events in memory, for exporting into Chrome trace json.
+	/// Install it with set_future_tracer, uninstall before destruction. All methods are thread-safe.
+	class chrome_trace_recorder : public future_tracer
+	{
+	public:
+		using clock_type = std::chrono::steady_clock;
+		using time_point = clock_type::time_point;
+
+		enum class event_kind : unsigned char
+		{
+			created,
+			satisfied,
+			execution,
+			continuation,
+		};
+
+		struct event
+		{
+			event_kind kind;
+			future_state reason = future_state::unsatisfied; // satisfied only
+			unsigned tid;                                    // small thread number, not os thread id
+			std::uint64_t state;                             // trace_id of state(continuation for continuation runs)
+			std::uint64_t caller = 0;                        // continuation only: trace_id of state continuation was run by
+			const std::type_info * type = nullptr;           // execution and continuation only
+			time_point start, finish;                        // finish - for execution and continuation only
+		};
+
+	private:
+		time_point m_start;
+		mutable std::mutex m_mutex;
+		std::vector<event> m_events;
+
+	private:
+		static unsigned current_tid() noexcept;
+		void record(event && ev) noexcept;
+		void start_span(event_kind kind, const shared_state_basic * state, const shared_state_basic * caller) noexcept;
+		void finish_span() noexcept;
+
+	public:
+		void created(const shared_state_basic * state) noexcept override;
+		void satisfied(const shared_state_basic * state, future_state reason) noexcept override;
+		void execution_started(const shared_state_basic * state) noexcept override;
+		void execution_finished(const shared_state_basic * state) noexcept override;
+		void continuation_started(const shared_state_basic * caller, const shared_state_basic * continuation) noexcept override;
+		void continuation_finished(const shared_state_basic * caller, const shared_state_basic * continuation) noexcept override;
+
+	public:
+		/// copy of recorded events
+		std::vector<event> events() const;
+		void clear();
+
+		/// writes recorded events as Chrome trace json
+		void write_json(std::ostream & os) const;
+		/// writes recorded events as Chrome trace json into file, throws std::runtime_error if it can't be written
+		void write_json(const std::string & path) const;
+
+	public:
+		chrome_trace_recorder() : m_start(clock_type::now()) {}
+	};
+}
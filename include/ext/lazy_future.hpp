@@ -0,0 +1,163 @@
+#pragma once
+// Lazy pipelines over ext::future.
+//
+// Chain like async(...).then(a).then(b).then(c) creates shared state for every step,
+// and every step is separate handoff: set_value, running continuations, possibly waking waiting thread.
+// lazy_future composes continuations at compile time into single functor, nothing is allocated or executed,
+// until pipeline is materialized:
+// * get()               - whole pipeline is executed right here, in calling thread;
+// * materialize(policy) - as single task of ext::async, deferred by default - executed on get/wait of returned future;
+// * submit(executor)    - as single task of executor, for example ext::thread_pool.
+//
+// Pipeline can start from functor - ext::lazy(f, args...), or from future - ext::lazy(future).
+// In latter case pipeline is materialized as single continuation of that future.
+//
+// Unlike ext::future::then, steps of pipeline receive value of previous step, not a future.
+// void returning step is followed by step taking no arguments.
+// Exception thrown by any step is propagated to result, following steps are not executed.
+
+#include <tuple>
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include <ext/future.hpp>
+
+namespace ext
+{
+	/// no source future marker of lazy_future
+	struct lazy_no_input {};
+
+	/// first step of pipeline started from future: takes future, returns it's value.
+	/// Value of shared_future is copied, future is not alive after this step
+	struct lazy_future_get
+	{
+		template <class Type>
+		Type operator()(ext::future<Type> future) const { return future.get(); }
+
+		template <class Type>
+		Type operator()(ext::shared_future<Type> future) const { return future.get(); }
+	};
+
+	/// composition of two steps: second(first(args...)), or first(args...), second() if first returns void
+	template <class First, class Second>
+	class lazy_compose
+	{
+		First m_first;
+		Second m_second;
+
+	public:
+		template <class ... Args>
+		decltype(auto) operator()(Args && ... args)
+		{
+			if constexpr (std::is_void_v<std::invoke_result_t<First &, Args...>>)
+			{
+				std::invoke(m_first, std::forward<Args>(args)...);
+				return std::invoke(m_second);
+			}
+			else
+				return std::invoke(m_second, std::invoke(m_first, std::forward<Args>(args)...));
+		}
+
+	public:
+		lazy_compose(First first, Second second)
+			: m_first(std::move(first)), m_second(std::move(second)) {}
+	};
+
+	/// lazy pipeline, see description at top of this file.
+	/// Input - source future type or lazy_no_input,
+	/// Functor - composed steps, invoked with source future or without arguments.
+	/// All methods consume pipeline and are callable only on rvalue.
+	template <class Input, class Functor>
+	class lazy_future
+	{
+		template <class, class> friend class lazy_future;
+
+	public:
+		static constexpr bool has_input = not std::is_same_v<Input, lazy_no_input>;
+
+		using functor_type = Functor;
+		using input_type   = Input;
+
+	private:
+		template <class Func, class In>
+		struct result_helper { using type = std::invoke_result_t<Func &, In>; };
+
+		template <class Func>
+		struct result_helper<Func, lazy_no_input> { using type = std::invoke_result_t<Func &>; };
+
+	public:
+		using value_type = typename result_helper<Functor, Input>::type;
+
+	private:
+		Input m_input;
+		Functor m_functor;
+
+	public:
+		/// appends step to pipeline
+		template <class Step>
+		auto then(Step && step) && -> lazy_future<Input, lazy_compose<Functor, std::decay_t<Step>>>
+		{
+			return {std::move(m_input), {std::move(m_functor), std::forward<Step>(step)}};
+		}
+
+		/// executes pipeline in calling thread, waits for source future if any
+		value_type get() &&
+		{
+			if constexpr (has_input)
+				return std::invoke(m_functor, std::move(m_input));
+			else
+				return std::invoke(m_functor);
+		}
+
+		/// materializes pipeline as single shared state:
+		/// pipeline with source future - continuation of that future, policy is ignored;
+		/// otherwise - ext::async task with given policy.
+		auto materialize(ext::launch policy = ext::launch::deferred) && -> ext::future<value_type>
+		{
+			if constexpr (has_input)
+				return std::move(m_input).then(std::move(m_functor));
+			else
+				return ext::async(policy, std::move(m_functor));
+		}
+
+		/// materializes pipeline as single task of executor.
+		/// Executor is any type with thread_pool-like methods submit(func) and submit(future, func), for example ext::thread_pool.
+		template <class Executor>
+		auto submit(Executor & executor) &&
+		{
+			if constexpr (has_input)
+				return executor.submit(std::move(m_input), std::move(m_functor));
+			else
+				return executor.submit(std::move(m_functor));
+		}
+
+	public:
+		lazy_future(Input input, Functor functor)
+			: m_input(std::move(input)), m_functor(std::move(functor)) {}
+	};
+
+	/// starts lazy pipeline from functor, args are decay copied into pipeline
+	template <class Function, class ... Args, class = std::enable_if_t<not is_future_type<std::decay_t<Function>>::value>>
+	auto lazy(Function && f, Args && ... args)
+	{
+		auto closure = [f = std::forward<Function>(f), args_tuple = std::make_tuple(std::forward<Args>(args)...)]() mutable -> decltype(auto)
+		{
+			return std::apply(f, std::move(args_tuple));
+		};
+
+		return lazy_future<lazy_no_input, decltype(closure)>(lazy_no_input(), std::move(closure));
+	}
+
+	/// starts lazy pipeline from future: first step receives it's value
+	template <class Type>
+	auto lazy(ext::future<Type> future)
+	{
+		return lazy_future<ext::future<Type>, lazy_future_get>(std::move(future), lazy_future_get());
+	}
+
+	template <class Type>
+	auto lazy(ext::shared_future<Type> future)
+	{
+		return lazy_future<ext::shared_future<Type>, lazy_future_get>(std::move(future), lazy_future_get());
+	}
+}
@@ -2,6 +2,7 @@
 #include <vector>
 #include <functional>
 #include <ext/utility.hpp> //for ext::first_el для batch_lru_cache
+#include <ext/cache_policies.hpp>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/hashed_index.hpp>
@@ -24,13 +25,31 @@ namespace ext
 	/// для получения данных используется не std::function, а функтор
 	/// специальные функторы function_acquire/batch_function_acquire позволяют не писать новый функтор,
 	/// а просто передать некое выражение в std::function<bool (Key, Val)>/std::function<bool (Key, vector<pair<Key, Val>> & )>
+	///
+	/// размер кеша ограничивается суммарным весом элементов, вес вычисляется функтором Weigher при вставке:
+	/// std::size_t w = Weigher(key, value) должно быть валидным.
+	/// По умолчанию вес каждого элемента 1 - ограничивается количество элементов,
+	/// с весом в байтах - maxsize задает бюджет памяти, что полезно при сильно различающихся размерах значений.
+	/// Вес запоминается при вставке, если значение изменено через возвращенную ссылку - вес нужно обновить повторным insert.
+	///
+	/// порядок вытеснения задается политикой Policy, см. ext/cache_policies.hpp:
+	/// lru_policy по умолчанию, clock_policy, arc_policy и tinylfu_policy - устойчивые к сканированию.
+
+	/// вес элемента по умолчанию - каждый элемент весит 1
+	struct lru_unit_weigher
+	{
+		template <class Key, class Value>
+		std::size_t operator()(const Key &, const Value &) const noexcept { return 1; }
+	};
 
 	/// кеш с ручной подгрузкой данных
 	template <
 		class Key,
 		class Value,
 		class Hash = boost::hash<Key>,
-		class KeyEqual = std::equal_to<>
+		class KeyEqual = std::equal_to<>,
+		class Weigher = lru_unit_weigher,
+		class Policy = lru_policy
 	>
 	class manual_lru_cache
 	{
@@ -42,15 +61,20 @@ namespace ext
 		typedef Value mapped_type;
 		typedef Hash hasher;
 		typedef KeyEqual key_equal;
+		typedef Weigher weigher_type;
+		typedef Policy policy_type;
 
 	private:
 		struct entry
 		{
 			key_type key;
 			mapped_type value;
+			std::size_t weight;
+			// данные политики вытеснения, не участвуют в индексе
+			mutable typename policy_type::entry_data policy_data;
 
-			entry(key_type && key, mapped_type && value)
-				: key(std::move(key)), value(std::move(value)) {}
+			entry(key_type && key, mapped_type && value, std::size_t weight)
+				: key(std::move(key)), value(std::move(value)), weight(weight) {}
 		};
 
 		typedef boost::multi_index_container <
@@ -70,48 +94,90 @@ namespace ext
 
 		typedef typename cache_container::template nth_index<ByCode>::type  code_view;
 		typedef typename cache_container::template nth_index<ByPos>::type   pos_view;
+		typedef typename policy_type::template impl<pos_view> policy_impl;
 
 	private:
 		cache_container m_cache;
 		std::size_t m_cache_maxsize;
+		std::size_t m_weight = 0;
+		weigher_type m_weigher;
+		policy_impl m_policy;
+
+		std::size_t policy_hash(const key_type & key) const
+		{
+			if constexpr (policy_type::needs_hash)
+				return m_cache.hash_function()(key);
+			else
+				return 0;
+		}
 
 		void touch(typename code_view::iterator it)
 		{
 			auto & pv = m_cache.template get<ByPos>();
 			auto posIt = m_cache.template project<ByPos>(it);
-			// перемещаем элемент по it в конец списка
-			pv.relocate(pv.end(), posIt);
+			// lru политика перемещает элемент по it в конец списка
+			m_policy.on_access(pv, posIt, policy_hash(it->key));
+		}
+
+		/// скидывает элемент, выбранный политикой
+		void evict(typename pos_view::iterator it)
+		{
+			auto & pv = m_cache.template get<ByPos>();
+			m_policy.on_evict(pv, it, policy_hash(it->key));
+			m_weight -= it->weight;
+			pv.erase(it);
+		}
+
+		/// скидывает элементы по выбору политики, пока суммарный вес больше limit.
+		/// элемент keep не скидывается, даже если он один весит больше limit
+		void shrink_to(std::size_t limit, typename pos_view::iterator keep)
+		{
+			auto & pv = m_cache.template get<ByPos>();
+			while (m_weight > limit)
+			{
+				auto victim = m_policy.victim(pv, keep);
+				if (victim == pv.end()) break;
+
+				evict(victim);
+			}
 		}
 
 	public:
-		/// скидывает наиболее давно используемый элемент
+		/// скидывает элемент, выбранный политикой, для lru_policy - наиболее давно используемый
 		void drop_last()
 		{
 			auto & pv = m_cache.template get<ByPos>();
-			pv.pop_front();
+			BOOST_ASSERT_MSG(not pv.empty(), "lru_cache: drop_last on empty cache");
+			evict(m_policy.victim(pv, pv.end()));
 		}
 
 		mapped_type & insert(key_type key, mapped_type data)
 		{
-			bool inserted;
-			typename code_view::iterator pos;
-			std::tie(pos, inserted) = m_cache.emplace(std::move(key), std::move(data));
-			
-			if (!inserted) {
+			BOOST_ASSERT_MSG(m_cache_maxsize > 0, "lru_cache can't work with CacheMaxSize == 0");
+			std::size_t weight = m_weigher(key, data);
+
+			// emplace constructs entry before checking for duplicate, moving data out,
+			// so existing element should be looked up first
+			auto pos = m_cache.find(key);
+			if (pos != m_cache.end()) {
 				// const_cast is safe because our index is only by key
-				auto & val = const_cast<mapped_type &>(pos->value);
-				boost::swap(val, data);
-				touch(pos);
-				return val;
+				auto & ent = const_cast<entry &>(*pos);
+				auto old_weight = ent.weight;
+				boost::swap(ent.value, data);
+				m_weight = m_weight - old_weight + weight;
+				ent.weight = weight;
+				m_policy.on_update(m_cache.template get<ByPos>(), m_cache.template project<ByPos>(pos), policy_hash(ent.key), old_weight);
 			}
 			else {
-				BOOST_ASSERT_MSG(m_cache_maxsize > 0, "lru_cache can't work with CacheMaxSize == 0");
-				if (m_cache_maxsize < m_cache.size())
-					drop_last();
-				
-				// const_cast is safe because our index is only by key
-				return const_cast<mapped_type &>(pos->value);
+				pos = m_cache.emplace(std::move(key), std::move(data), weight).first;
+				m_weight += weight;
+				m_policy.on_insert(m_cache.template get<ByPos>(), m_cache.template project<ByPos>(pos), policy_hash(pos->key));
 			}
+
+			// new or grown element can push out several old ones, but not itself
+			shrink_to(m_cache_maxsize, m_cache.template project<ByPos>(pos));
+			// const_cast is safe because our index is only by key
+			return const_cast<mapped_type &>(pos->value);
 		}
 
 		/// получает данные по ключу, если таких данных нет, то throws std::out_of_range
@@ -137,17 +203,51 @@ namespace ext
 			}
 		}
 
+		/// получает данные по ключу без обновления позиции в lru списке, если таких данных нет, то returns nullptr
+		const mapped_type * peek_ptr(key_param key) const
+		{
+			auto it = m_cache.find(key);
+			return it == m_cache.end() ? nullptr : &it->value;
+		}
+
+		/// помечает элемент по ключу как последний использованный, returns false если такого элемента нет
+		bool touch(key_param key)
+		{
+			auto it = m_cache.find(key);
+			if (it == m_cache.end())
+				return false;
+
+			touch(it);
+			return true;
+		}
+
+		/// удаляет элемент по ключу, returns false если такого элемента нет
+		bool erase(key_param key)
+		{
+			auto it = m_cache.find(key);
+			if (it == m_cache.end())
+				return false;
+
+			m_policy.on_erase(m_cache.template get<ByPos>(), m_cache.template project<ByPos>(it));
+			m_weight -= it->weight;
+			m_cache.erase(it);
+			return true;
+		}
+
 		/// сбрасывает кеш
-		void clear()                 { m_cache.clear(); }
+		void clear()                 { m_cache.clear(); m_weight = 0; m_policy.clear(); }
+		/// количество элементов
 		std::size_t size() const     { return m_cache.size(); }
+		/// суммарный вес элементов, с весом по умолчанию совпадает с size
+		std::size_t weight() const   { return m_weight; }
+		/// максимальный суммарный вес элементов
 		std::size_t maxsize() const  { return m_cache_maxsize; }
 
-		/// скидывает элменты так что бы размер кеша не превышал size
+		/// скидывает элменты так что бы суммарный вес кеша не превышал size
 		void drop_to(std::size_t size)
 		{
 			auto & pv = m_cache.template get<ByPos>();
-			for (auto cursz = m_cache.size(); cursz > size; --cursz)
-				pv.pop_front();
+			shrink_to(size, pv.end());
 		}
 
 		void set_maxsize(std::size_t size)
@@ -155,12 +255,16 @@ namespace ext
 			if (size == 0)
 				throw std::invalid_argument("lru_cache: CacheMaxSize == 0 is invalid");
 			
+			m_policy.set_capacity(size);
 			drop_to(size);
 			m_cache_maxsize = size;
 		}
 
-		explicit manual_lru_cache(std::size_t size)
-			: m_cache_maxsize(size) {}
+		explicit manual_lru_cache(std::size_t size, weigher_type weigher = weigher_type())
+			: m_cache_maxsize(size), m_weigher(std::move(weigher))
+		{
+			m_policy.set_capacity(size);
+		}
 
 		manual_lru_cache(const manual_lru_cache &) = delete;
 		manual_lru_cache & operator =(const manual_lru_cache &) = delete;
@@ -172,12 +276,15 @@ namespace ext
 		{
 			boost::swap(m_cache, other.m_cache);
 			boost::swap(m_cache_maxsize, other.m_cache_maxsize);
+			boost::swap(m_weight, other.m_weight);
+			boost::swap(m_weigher, other.m_weigher);
+			boost::swap(m_policy, other.m_policy);
 		}
 	};
 
-	template <class Key, class Value, class Hash, class KeyEqual>
-	inline void swap(manual_lru_cache<Key, Value, Hash, KeyEqual> & c1,
-	                 manual_lru_cache<Key, Value, Hash, KeyEqual> & c2) noexcept
+	template <class Key, class Value, class Hash, class KeyEqual, class Weigher, class Policy>
+	inline void swap(manual_lru_cache<Key, Value, Hash, KeyEqual, Weigher, Policy> & c1,
+	                 manual_lru_cache<Key, Value, Hash, KeyEqual, Weigher, Policy> & c2) noexcept
 	{
 		c1.swap(c2);
 	}
@@ -190,11 +297,13 @@ namespace ext
 		class Value,
 		class Hash = boost::hash<Key>,
 		class KeyEqual = std::equal_to<>,
-		class Acquire = std::function<Value(const Key &)>
+		class Acquire = std::function<Value(const Key &)>,
+		class Weigher = lru_unit_weigher,
+		class Policy = lru_policy
 	>
-	class lru_cache : private manual_lru_cache<Key, Value, Hash, KeyEqual>
+	class lru_cache : private manual_lru_cache<Key, Value, Hash, KeyEqual, Weigher, Policy>
 	{
-		typedef manual_lru_cache<Key, Value, Hash, KeyEqual> base_type;
+		typedef manual_lru_cache<Key, Value, Hash, KeyEqual, Weigher, Policy> base_type;
 		
 	public:
 		using typename base_type::key_type;
@@ -202,6 +311,8 @@ namespace ext
 		using typename base_type::hasher;
 		using typename base_type::key_equal;
 		using typename base_type::key_param;
+		using typename base_type::weigher_type;
+		using typename base_type::policy_type;
 
 	private:
 		Acquire m_Acquire;
@@ -215,6 +326,7 @@ namespace ext
 	public:
 		using base_type::clear;
 		using base_type::size;
+		using base_type::weight;
 		using base_type::maxsize;
 		using base_type::drop_last;
 		using base_type::drop_to;
@@ -228,8 +340,8 @@ namespace ext
 			return *val;
 		}
 
-		explicit lru_cache(std::size_t size, Acquire ac)
-			: base_type(size), m_Acquire(std::move(ac)) {}
+		explicit lru_cache(std::size_t size, Acquire ac, weigher_type weigher = weigher_type())
+			: base_type(size, std::move(weigher)), m_Acquire(std::move(ac)) {}
 
 		lru_cache(const lru_cache &) = delete;
 		lru_cache & operator =(const lru_cache &) = delete;
@@ -244,9 +356,9 @@ namespace ext
 		}
 	};
 
-	template <class Key, class Value, class Hash, class KeyEqual, class Acquire>
-	inline void swap(lru_cache<Key, Value, Hash, KeyEqual, Acquire> & c1,
-	                 lru_cache<Key, Value, Hash, KeyEqual, Acquire> & c2) noexcept
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	inline void swap(lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy> & c1,
+	                 lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy> & c2) noexcept
 	{
 		c1.swap(c2);
 	}
@@ -263,11 +375,13 @@ namespace ext
 		class Value,
 		class Hash,
 		class KeyEqual,
-		class Acquire
+		class Acquire,
+		class Weigher = lru_unit_weigher,
+		class Policy = lru_policy
 	>
-	class batch_lru_cache : private manual_lru_cache<Key, Value>
+	class batch_lru_cache : private manual_lru_cache<Key, Value, Hash, KeyEqual, Weigher, Policy>
 	{
-		typedef manual_lru_cache<Key, Value, Hash, KeyEqual> base_type;
+		typedef manual_lru_cache<Key, Value, Hash, KeyEqual, Weigher, Policy> base_type;
 
 	public:
 		using typename base_type::key_type;
@@ -275,6 +389,8 @@ namespace ext
 		using typename base_type::hasher;
 		using typename base_type::key_equal;
 		using typename base_type::key_param;
+		using typename base_type::weigher_type;
+		using typename base_type::policy_type;
 
 	private:
 		Acquire m_Acquire;
@@ -306,6 +422,7 @@ namespace ext
 	public:
 		using base_type::clear;
 		using base_type::size;
+		using base_type::weight;
 		using base_type::maxsize;
 		using base_type::drop_last;
 		using base_type::drop_to;
@@ -319,8 +436,8 @@ namespace ext
 			return *val;
 		}
 
-		explicit batch_lru_cache(std::size_t maxSize, Acquire ac)
-			: base_type(maxSize), m_Acquire(std::move(ac)) {}
+		explicit batch_lru_cache(std::size_t maxSize, Acquire ac, weigher_type weigher = weigher_type())
+			: base_type(maxSize, std::move(weigher)), m_Acquire(std::move(ac)) {}
 			
 		batch_lru_cache(const batch_lru_cache &) = delete;
 		batch_lru_cache & operator =(const batch_lru_cache &) = delete;
@@ -335,9 +452,9 @@ namespace ext
 		}
 	};
 
-	template <class Key, class Value, class Hash, class KeyEqual, class Acquire>
-	inline void swap(batch_lru_cache<Key, Value, Hash, KeyEqual, Acquire> & c1,
-	                 batch_lru_cache<Key, Value, Hash, KeyEqual, Acquire> & c2) noexcept
+	template <class Key, class Value, class Hash, class KeyEqual, class Acquire, class Weigher, class Policy>
+	inline void swap(batch_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy> & c1,
+	                 batch_lru_cache<Key, Value, Hash, KeyEqual, Acquire, Weigher, Policy> & c2) noexcept
 	{
 		c1.swap(c2);
 	}
@@ -0,0 +1,214 @@
+#pragma once
+// Cooperative cancellation: stop_source, stop_token, stop_callback.
+// Analog of C++20 std::stop_source/std::stop_token/std::stop_callback, usable with C++17.
+//
+// stop_source requests stop, stop_token observes it, stop_callback registers functor invoked on stop request.
+// All copies of stop_source and stop_token obtained from it share one stop state.
+//
+// Stop request is sticky: once requested it can't be reset.
+// Callbacks are invoked synchronously by thread calling request_stop, each exactly once;
+// callback registered after stop was requested - is invoked immediately in registering thread.
+// Destructor of stop_callback unregisters it, if callback is being invoked concurrently by other thread -
+// waits for it's completion, so it's safe to destroy objects used by callback right after stop_callback destruction.
+//
+// ext::future integration(cancel_on_stop, then/when_all/when_any with stop_token) - see ext/future.hpp,
+// ext::thread_pool::submit(stop_token, func, args...) - see ext/thread_pool.hpp.
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+#include <ext/intrusive_ptr.hpp>
+
+namespace ext
+{
+	class stop_state;
+	class stop_token;
+	class stop_source;
+	class stop_callback_base;
+
+	/// shared stop state of stop_source/stop_token: stop flag and list of registered callbacks
+	class stop_state
+	{
+		friend stop_callback_base;
+
+	private:
+		std::atomic_uint m_refs = ATOMIC_VAR_INIT(1);
+		std::atomic_bool m_stop_requested = ATOMIC_VAR_INIT(false);
+
+		std::mutex m_mutex;
+		std::condition_variable m_invoked;
+		// registered callbacks, doubly linked list
+		stop_callback_base * m_head = nullptr;
+		// callback currently invoked by request_stop and thread invoking it
+		stop_callback_base * m_invoking = nullptr;
+		std::thread::id m_stopping_thread;
+
+	private:
+		void unlink(stop_callback_base * callback) noexcept;
+		/// registers callback, returns false if stop already requested - callback is not registered then
+		bool add(stop_callback_base * callback) noexcept;
+		/// unregisters callback, waits if it's being invoked concurrently
+		void remove(stop_callback_base * callback) noexcept;
+
+	public:
+		bool stop_requested() const noexcept { return m_stop_requested.load(std::memory_order_acquire); }
+		/// requests stop and invokes registered callbacks, returns false if stop was already requested
+		bool request_stop() noexcept;
+
+	public:
+		friend inline void intrusive_ptr_add_ref(stop_state * ptr) noexcept { ptr->m_refs.fetch_add(1, std::memory_order_relaxed); }
+		friend inline unsigned intrusive_ptr_use_count(const stop_state * ptr) noexcept { return ptr->m_refs.load(std::memory_order_relaxed); }
+		friend inline void intrusive_ptr_release(stop_state * ptr) noexcept
+		{
+			if (ptr->m_refs.fetch_sub(1, std::memory_order_release) == 1)
+			{
+				std::atomic_thread_fence(std::memory_order_acquire);
+				delete ptr;
+			}
+		}
+
+	public:
+		stop_state() = default;
+		~stop_state() noexcept = default;
+
+		stop_state(const stop_state &) = delete;
+		stop_state & operator =(const stop_state &) = delete;
+	};
+
+	/// observer of stop state. Default constructed token has no state and stop can never be requested for it
+	class stop_token
+	{
+		friend stop_source;
+		friend stop_callback_base;
+
+	private:
+		ext::intrusive_ptr<stop_state> m_state;
+
+	private:
+		stop_token(ext::intrusive_ptr<stop_state> state) noexcept : m_state(std::move(state)) {}
+
+	public:
+		bool stop_requested() const noexcept { return m_state and m_state->stop_requested(); }
+		bool stop_possible()  const noexcept { return static_cast<bool>(m_state); }
+
+		void swap(stop_token & other) noexcept { std::swap(m_state, other.m_state); }
+
+		friend bool operator ==(const stop_token & t1, const stop_token & t2) noexcept { return t1.m_state == t2.m_state; }
+		friend bool operator !=(const stop_token & t1, const stop_token & t2) noexcept { return not (t1.m_state == t2.m_state); }
+
+	public:
+		stop_token() noexcept = default;
+	};
+
+	/// requester of stop, copies share same stop state
+	class stop_source
+	{
+	private:
+		ext::intrusive_ptr<stop_state> m_state;
+
+	public:
+		stop_token get_token() const noexcept { return m_state; }
+
+		bool stop_requested() const noexcept { return m_state->stop_requested(); }
+		/// requests stop, invokes registered callbacks in calling thread. Returns false if stop was already requested
+		bool request_stop() noexcept { return m_state->request_stop(); }
+
+		void swap(stop_source & other) noexcept { std::swap(m_state, other.m_state); }
+
+		friend bool operator ==(const stop_source & s1, const stop_source & s2) noexcept { return s1.m_state == s2.m_state; }
+		friend bool operator !=(const stop_source & s1, const stop_source & s2) noexcept { return not (s1.m_state == s2.m_state); }
+
+	public:
+		stop_source() : m_state(new stop_state, ext::noaddref) {}
+	};
+
+	/// base of stop callbacks: intrusive list hook and registration logic.
+	/// Derived class implements invoke and calls attach/detach, usually from constructor/destructor.
+	class stop_callback_base
+	{
+		friend stop_state;
+
+	private:
+		stop_callback_base * m_prev = nullptr;
+		stop_callback_base * m_next = nullptr;
+		bool m_linked = false;
+		ext::intrusive_ptr<stop_state> m_state;
+
+	protected:
+		/// called on stop request, at most once
+		virtual void invoke() noexcept = 0;
+
+		/// registers this callback in stop state of token, if stop already requested - invokes it immediately.
+		/// Must be called at most once
+		void attach(const stop_token & token) noexcept;
+		/// unregisters this callback, if it's being invoked concurrently - waits for completion
+		void detach() noexcept;
+
+	protected:
+		stop_callback_base() = default;
+		virtual ~stop_callback_base() = default;
+
+		stop_callback_base(const stop_callback_base &) = delete;
+		stop_callback_base & operator =(const stop_callback_base &) = delete;
+	};
+
+	/// registers callback for stop token for lifetime of this object, see description at top of this file
+	template <class Callback>
+	class stop_callback : private stop_callback_base
+	{
+	private:
+		Callback m_callback;
+
+	private:
+		void invoke() noexcept override { m_callback(); }
+
+	public:
+		using callback_type = Callback;
+
+	public:
+		template <class CallbackArg>
+		explicit stop_callback(const stop_token & token, CallbackArg && callback)
+			: m_callback(std::forward<CallbackArg>(callback))
+		{
+			attach(token);
+		}
+
+		~stop_callback() noexcept { detach(); }
+	};
+
+	template <class Callback>
+	stop_callback(stop_token, Callback) -> stop_callback<Callback>;
+
+
+	/// whether functor accepts stop_token as first argument: func(token, args...)
+	template <class Functor, class ... Args>
+	constexpr bool accepts_stop_token_v = std::is_invocable_v<Functor, const stop_token &, Args...>;
+
+	// sfinae friendly: no type member if functor is not invocable at all
+	template <bool AcceptsToken, class Functor, class ... Args>
+	struct invoke_with_stop_token_result_helper : std::invoke_result<Functor, Args...> {};
+
+	template <class Functor, class ... Args>
+	struct invoke_with_stop_token_result_helper<true, Functor, Args...> : std::invoke_result<Functor, const stop_token &, Args...> {};
+
+	template <class Functor, class ... Args>
+	using invoke_with_stop_token_result_t = typename invoke_with_stop_token_result_helper<accepts_stop_token_v<Functor, Args...>, Functor, Args...>::type;
+
+	/// invokes func(token, args...) if functor accepts stop_token as first argument, func(args...) otherwise
+	template <class Functor, class ... Args>
+	decltype(auto) invoke_with_stop_token(Functor && func, const stop_token & token, Args && ... args)
+	{
+		if constexpr (accepts_stop_token_v<Functor, Args...>)
+			return std::invoke(std::forward<Functor>(func), token, std::forward<Args>(args)...);
+		else
+			return std::invoke(std::forward<Functor>(func), std::forward<Args>(args)...);
+	}
+
+
+	inline void swap(stop_token & t1, stop_token & t2) noexcept { t1.swap(t2); }
+	inline void swap(stop_source & s1, stop_source & s2) noexcept { s1.swap(s2); }
+}
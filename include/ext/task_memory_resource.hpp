@@ -0,0 +1,136 @@
+#pragma once
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <memory_resource>
+
+#include <ext/intrusive_ptr.hpp>
+
+namespace ext
+{
+	/// memory resource for small, short-lived objects, like tasks of thread_pool and threaded_scheduler.
+	/// Memory is managed by size classes(multiple of granularity, up to max_block_size),
+	/// every size class holds free lists, sharded by threads: thread allocates and deallocates into it's own shard,
+	/// so threads mostly do not contend with each other. When free list is empty - new slab of blocks is allocated from upstream.
+	/// Slabs are returned to upstream only on destruction.
+	/// Bigger or over-aligned requests are forwarded to upstream.
+	///
+	/// Resource must outlive all objects allocated from it,
+	/// it can be shared by multiple thread_pool/threaded_scheduler objects. All methods are thread-safe.
+	class task_memory_resource : public std::pmr::memory_resource
+	{
+	public:
+		static constexpr std::size_t granularity = alignof(std::max_align_t);
+		static constexpr std::size_t max_block_size = 512;
+		static constexpr unsigned    shard_count = 8;
+
+	private:
+		static constexpr std::size_t class_count = max_block_size / granularity;
+		static constexpr std::size_t cacheline_size = 64;
+
+		struct free_block
+		{
+			free_block * next;
+		};
+
+		struct alignas(cacheline_size) shard
+		{
+			std::mutex mutex;
+			free_block * head = nullptr;
+		};
+
+		struct size_class
+		{
+			shard shards[shard_count];
+		};
+
+		struct slab
+		{
+			void * ptr;
+			std::size_t size;
+		};
+
+	private:
+		std::pmr::memory_resource * m_upstream;
+		std::size_t m_blocks_per_slab;
+		std::unique_ptr<size_class[]> m_classes;
+
+		std::mutex m_slabs_mutex;
+		std::vector<slab> m_slabs;
+
+	private:
+		static unsigned current_shard() noexcept;
+		free_block * allocate_slab(std::size_t block_size);
+
+	protected:
+		void * do_allocate(std::size_t bytes, std::size_t alignment) override;
+		void do_deallocate(void * ptr, std::size_t bytes, std::size_t alignment) override;
+		bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override { return this == &other; }
+
+	public:
+		std::pmr::memory_resource * upstream_resource() const noexcept { return m_upstream; }
+
+	public:
+		explicit task_memory_resource(std::size_t blocks_per_slab = 64, std::pmr::memory_resource * upstream = std::pmr::get_default_resource());
+		~task_memory_resource() noexcept;
+
+		task_memory_resource(const task_memory_resource &) = delete;
+		task_memory_resource & operator =(const task_memory_resource &) = delete;
+	};
+
+	/// shared state(task, continuation) placed in memory of memory_resource:
+	/// instead of deleting itself - destroys itself and deallocates memory back into resource
+	template <class Base>
+	class pmr_allocated final : public Base
+	{
+		std::pmr::memory_resource * m_resource;
+
+	public:
+		unsigned release() noexcept override;
+
+	public:
+		template <class ... Args>
+		pmr_allocated(std::pmr::memory_resource * resource, Args && ... args)
+			: Base(std::forward<Args>(args)...), m_resource(resource) {}
+	};
+
+	template <class Base>
+	unsigned pmr_allocated<Base>::release() noexcept
+	{
+		// same as shared_state_basic::release, but memory belongs to resource
+		auto ref = this->m_refs.fetch_sub(1, std::memory_order_release);
+		if (ref == 1)
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			auto * resource = m_resource;
+			this->~pmr_allocated();
+			resource->deallocate(this, sizeof(pmr_allocated), alignof(pmr_allocated));
+		}
+
+		return --ref;
+	}
+
+	/// creates shared state object of type Type:
+	/// if resource is null - via new, otherwise as pmr_allocated<Type> in memory of given resource
+	template <class Type, class ... Args>
+	ext::intrusive_ptr<Type> make_pmr_intrusive(std::pmr::memory_resource * resource, Args && ... args)
+	{
+		if (not resource)
+			return ext::make_intrusive<Type>(std::forward<Args>(args)...);
+
+		using object_type = pmr_allocated<Type>;
+		void * ptr = resource->allocate(sizeof(object_type), alignof(object_type));
+
+		try
+		{
+			return ext::intrusive_ptr<Type>(new (ptr) object_type(resource, std::forward<Args>(args)...), ext::noaddref);
+		}
+		catch (...)
+		{
+			resource->deallocate(ptr, sizeof(object_type), alignof(object_type));
+			throw;
+		}
+	}
+}
@@ -4,18 +4,157 @@
 #include <condition_variable>
 #include <thread>
 
+#include <array>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <memory_resource>
+
 #include <boost/intrusive/list.hpp>
 #include <ext/intrusive_ptr.hpp>
 #include <ext/future.hpp>
+#include <ext/task_memory_resource.hpp>
 
 namespace ext
 {
+	/// thread_pool operation flags, can be combined
+	enum class thread_pool_flags : unsigned
+	{
+		none = 0,
+		/// every worker have it's own task deque, tasks submitted from worker thread are placed into it,
+		/// idle workers steal tasks from deques of other workers. See thread_pool description
+		work_stealing = 1,
+		/// normal priority tasks submitted from foreign threads are placed into bounded lock-free MPMC queue,
+		/// when it's full - into shared list. See thread_pool description
+		lockfree_queue = 2,
+	};
+
+	constexpr thread_pool_flags operator |(thread_pool_flags f1, thread_pool_flags f2) noexcept
+	{ return static_cast<thread_pool_flags>(static_cast<unsigned>(f1) | static_cast<unsigned>(f2)); }
+
+	constexpr bool operator &(thread_pool_flags f1, thread_pool_flags f2) noexcept
+	{ return static_cast<unsigned>(f1) & static_cast<unsigned>(f2); }
+
+	/// priority class of task submitted into thread_pool, see thread_pool description
+	enum class task_priority : unsigned
+	{
+		/// latency sensitive tasks
+		high = 0,
+		/// default priority
+		normal = 1,
+		/// bulk background work, executed when there is nothing more important
+		background = 2,
+	};
+
+	/// snapshot of thread_pool runtime statistics, see thread_pool::stats.
+	/// Counters are collected per worker without synchronization and are not exactly consistent with each other.
+	struct thread_pool_stats
+	{
+		typedef std::chrono::steady_clock::duration duration;
+
+		/// number of buckets in queue wait latency histogram
+		static constexpr unsigned latency_buckets = 24;
+
+		struct worker_stats
+		{
+			/// tasks executed by this worker
+			std::uint64_t executed;
+			/// time spent executing finished tasks
+			duration busy_time;
+			/// for how long currently executing task is running, zero if worker is idle
+			duration running_time;
+			/// time spent waiting for tasks, including looking for them
+			duration idle_time;
+		};
+
+		/// number of tasks waiting for execution, delayed tasks are not included
+		std::size_t queue_depth;
+		/// number of delayed tasks waiting for their futures(m_delayed continuations)
+		std::size_t delayed;
+
+		/// total tasks submitted, including delayed ones(counted on submit), parallel_for chunks are counted as tasks.
+		std::uint64_t submitted;
+		/// total tasks executed, including by already stopped workers
+		std::uint64_t executed;
+		/// total tasks abandoned by clear/destruction
+		std::uint64_t abandoned;
+
+		/// histogram of time tasks spent in queue before execution,
+		/// bucket 0 - less than 1us, bucket i - [2^(i-1), 2^i) us, last bucket - everything above.
+		std::array<std::uint64_t, latency_buckets> queue_wait;
+
+		/// stats of working workers, stopped workers are not included
+		std::vector<worker_stats> workers;
+	};
+
+	/// how cpu set given to thread_pool::set_affinity is applied to workers
+	enum class thread_pool_affinity : unsigned
+	{
+		/// every worker can run on any cpu from set
+		pool_wide,
+		/// worker i is pinned to cpu set[i % set.size()]
+		per_worker,
+	};
+
+	/// options of thread_pool automatic scaling, see thread_pool::enable_autoscaling
+	struct thread_pool_autoscale_options
+	{
+		typedef std::chrono::steady_clock::duration duration;
+
+		/// bounds of number of workers
+		unsigned min_workers = 1;
+		/// hardware_concurrency can be 0 if it's not known, parentheses protect from windows.h max macro
+		unsigned max_workers = (std::max)(1u, std::thread::hardware_concurrency());
+		/// how often controller makes decision
+		duration interval = std::chrono::milliseconds(100);
+		/// pool grows if more than grow_fraction of tasks executed during interval waited in queue longer than grow_wait
+		duration grow_wait = std::chrono::milliseconds(1);
+		double grow_fraction = 0.1;
+		/// pool shrinks by one worker if workers were idle more than shrink_idle fraction of interval
+		double shrink_idle = 0.5;
+	};
+
 	/// simple thread_pool implementation.
 	/// Task can be submitted via submit method.
 	/// For every task result of execution can be retrieved via associated future.
 	/// Number of running threads can be controlled via set_nworkers/get_nworkers methods.
 	/// By default thread_pool constructed with 0 workers, you must explicitly set number you want.
-	/// 
+	///
+	/// By default all tasks are placed into one shared list protected by mutex.
+	/// With thread_pool_flags::work_stealing every worker also gets it's own task deque:
+	///  * tasks submitted from worker thread of this pool are pushed into deque of that worker,
+	///    other tasks(submitted from foreign threads, delayed tasks) are placed into shared list;
+	///  * worker takes tasks from it's own deque in LIFO order, than from shared list,
+	///    and when both are empty - steals from deques of other workers in FIFO order;
+	///  * when worker is stopped, tasks left in it's deque are moved into shared list.
+	///
+	/// Tasks can be submitted with task_priority, every priority class have it's own shared list(lane).
+	/// By default lanes are drained strictly: task is taken from most prioritized non empty lane.
+	/// With set_priority_weights lanes are drained by weighted round robin:
+	/// in every round lane gives at most weight tasks, lanes with weight 0 are served only when others are empty.
+	/// In work stealing mode only normal priority tasks are placed into worker deques,
+	/// worker serves own deque after high lane, but before normal and background ones.
+	///
+	/// With thread_pool_flags::lockfree_queue normal priority tasks are pushed into bounded lock-free MPMC ring,
+	/// producers and consumers do not contend on mutex. When ring is full - tasks are placed into normal lane.
+	/// Workers take tasks from ring without locking if high lane is empty(weighted policy can be bypassed by this).
+	/// Delayed tasks and bulk tasks always go through lanes.
+	///
+	/// Pool collects runtime statistics(see stats method), counters are per worker and cheap to update.
+	/// With enable_autoscaling background controller uses them to grow/shrink number of workers via set_nworkers.
+	///
+	/// Workers can be pinned to cpus with set_affinity and named with set_thread_name(visible in top, perf, debuggers),
+	/// settings are applied to running workers and to workers created later.
+	///
+	/// Idle worker parks on condition variable, submit wakes it only if there are parked workers.
+	/// Wake up is relatively costly, with set_idle_policy worker before parking
+	/// can spin for some time(with cpu pause instruction), then yield for some time, waiting for new tasks.
+	///
 	/// All methods are thread-safe
 	class thread_pool
 	{
@@ -23,11 +162,19 @@ namespace ext
 			boost::intrusive::link_mode<boost::intrusive::link_mode_type::normal_link>
 		> hook_type;
 
+		typedef boost::intrusive::base_hook<hook_type> item_list_option;
+
 	private:
 		/// base interface for submitted tasks,
 		/// tasks are hold in intrusive linked list.
 		class task_base : public hook_type
 		{
+		public:
+			// lane this task is placed into, set on submission
+			task_priority m_priority = task_priority::normal;
+			// when task was placed into queue, used for queue wait statistics
+			std::chrono::steady_clock::time_point m_enqueued;
+
 		public:
 			virtual ~task_base() = default;
 
@@ -54,8 +201,9 @@ namespace ext
 			typedef ext::packaged_once_task_impl<Functor, ResultType()> base_type;
 
 		public:
+			// release is virtual, derived classes can override it and manage memory differently
 			void task_addref()  noexcept override { base_type::addref(); }
-			void task_release() noexcept override { base_type::release(); }
+			void task_release() noexcept override { this->release(); }
 			void task_abandone() noexcept override { base_type::release_promise(); }
 			void task_execute() noexcept override { base_type::execute(); }
 
@@ -69,6 +217,121 @@ namespace ext
 			friend inline void intrusive_ptr_use_count(const task_impl * ptr) noexcept {}
 		};
 
+		/// memory block holding tasks submitted via submit_bulk.
+		/// Tasks are constructed in one array, block is freed when last task from it is destroyed.
+		/// Block and task array are allocated from thread_pool memory resource.
+		class bulk_block_base
+		{
+			// number of alive tasks + 1 while block is being filled
+			std::atomic_size_t m_refs = ATOMIC_VAR_INIT(1);
+
+		protected:
+			/// destroys block and deallocates it's memory
+			virtual void destroy() noexcept = 0;
+
+		public:
+			void task_acquired() noexcept { m_refs.fetch_add(1, std::memory_order_relaxed); }
+			void task_released() noexcept;
+
+		protected:
+			~bulk_block_base() = default;
+		};
+
+		template <class Task, class Functor>
+		class bulk_block final : public bulk_block_base
+		{
+		public:
+			std::pmr::memory_resource * m_resource;
+			Functor m_func;
+			Task * m_tasks;
+			std::size_t m_count;
+
+		protected:
+			void destroy() noexcept override;
+
+		private:
+			bulk_block(std::pmr::memory_resource * resource, Functor func, std::size_t count);
+			~bulk_block();
+
+		public:
+			/// creates block in memory of resource, null - via new_delete_resource
+			static bulk_block * create(std::pmr::memory_resource * resource, Functor func, std::size_t count);
+		};
+
+		/// closure of bulk task: calls shared functor, stored in bulk_block, with own argument
+		template <class Functor, class Arg>
+		struct bulk_closure
+		{
+			Functor * func;
+			Arg arg;
+
+			decltype(auto) operator()() { return ext::invoke(*func, std::move(arg)); }
+		};
+
+		/// task_impl placed in bulk_block, instead of deleting itself - destroys itself and releases block
+		template <class Functor, class ResultType>
+		class bulk_task_impl : public task_impl<Functor, ResultType>
+		{
+			typedef task_impl<Functor, ResultType> base_type;
+
+		private:
+			bulk_block_base * m_block;
+
+		public:
+			unsigned release() noexcept override;
+
+		public:
+			bulk_task_impl(bulk_block_base * block, Functor func)
+				: base_type(std::move(func)), m_block(block) {}
+		};
+
+		/// shared state of parallel_for call: range is split into chunks, each chunk is a task.
+		/// Chunks are stored in this object and share it's lifetime,
+		/// state becomes ready when all chunks are executed.
+		template <class Range, class Functor>
+		class parallel_for_task : public ext::shared_state<void>
+		{
+			friend thread_pool;
+			using iterator = decltype(std::begin(std::declval<Range &>()));
+
+			class chunk : public task_base
+			{
+				parallel_for_task * m_owner;
+				iterator m_first, m_last;
+
+			public:
+				void task_addref()   noexcept override { m_owner->addref(); }
+				void task_release()  noexcept override { m_owner->release(); }
+				void task_abandone() noexcept override { m_owner->chunk_abandoned(); }
+				void task_execute()  noexcept override { m_owner->execute_chunk(m_first, m_last); }
+
+			public:
+				chunk(parallel_for_task * owner, iterator first, iterator last)
+					: m_owner(owner), m_first(std::move(first)), m_last(std::move(last)) {}
+			};
+
+		private:
+			Range m_range;
+			Functor m_func;
+			std::pmr::vector<chunk> m_chunks;
+
+			std::atomic_size_t m_count = ATOMIC_VAR_INIT(0);
+			std::atomic_bool m_failed = ATOMIC_VAR_INIT(false);
+			std::atomic_bool m_abandoned = ATOMIC_VAR_INIT(false);
+			std::exception_ptr m_error;
+
+		private:
+			void chunk_finished() noexcept;
+			void chunk_abandoned() noexcept;
+			void execute_chunk(iterator first, iterator last) noexcept;
+
+		public:
+			/// chunks are allocated from resource, null - via new_delete_resource
+			parallel_for_task(std::pmr::memory_resource * resource, Range && range, Functor func)
+				: m_range(std::forward<Range>(range)), m_func(std::move(func)),
+				  m_chunks(resource ? resource : std::pmr::new_delete_resource()) {}
+		};
+
 		class delayed_task_continuation :
 			public ext::continuation_base,
 			public hook_type
@@ -86,7 +349,71 @@ namespace ext
 			delayed_task_continuation(thread_pool * owner, ext::intrusive_ptr<task_base> task)
 				: m_owner(owner), m_task(std::move(task)) {}
 		};
-		
+
+		typedef boost::intrusive::list<
+			task_base, item_list_option,
+			boost::intrusive::constant_time_size<false>
+		> task_list_type;
+
+		typedef boost::intrusive::list <
+			delayed_task_continuation, item_list_option,
+			boost::intrusive::constant_time_size<false>
+		> delayed_task_continuation_list;
+
+		/// bounded lock-free MPMC queue of task pointers(Dmitry Vyukov algorithm).
+		/// Intrusive hook of task_base is not used while task is in the ring
+		class task_ring
+		{
+			struct cell
+			{
+				std::atomic_size_t sequence;
+				task_base * task;
+			};
+
+			static constexpr std::size_t cacheline_size = 64;
+
+		private:
+			std::unique_ptr<cell[]> m_cells;
+			std::size_t m_mask;
+			// enqueue and dequeue positions are placed on different cache lines
+			alignas(cacheline_size) std::atomic_size_t m_enqueue_pos = ATOMIC_VAR_INIT(0);
+			alignas(cacheline_size) std::atomic_size_t m_dequeue_pos = ATOMIC_VAR_INIT(0);
+
+		public:
+			/// pushes task, returns false if ring is full
+			bool push(task_base * task) noexcept;
+			/// pops task, returns nullptr if ring is empty
+			auto pop() noexcept -> task_base *;
+			/// approximate emptiness check
+			bool empty() const noexcept;
+			/// approximate number of tasks
+			std::size_t size() const noexcept;
+
+		public:
+			/// capacity must be power of 2
+			explicit task_ring(std::size_t capacity);
+		};
+
+		/// statistics counters, see thread_pool_stats.
+		/// Worker counters are updated only by owning worker, so just relaxed load/store without read-modify-write
+		struct worker_counters
+		{
+			std::atomic<std::uint64_t> executed = ATOMIC_VAR_INIT(0);
+			std::atomic<std::chrono::steady_clock::rep> busy = ATOMIC_VAR_INIT(0);
+			std::atomic<std::chrono::steady_clock::rep> idle = ATOMIC_VAR_INIT(0);
+			// start time of currently executing task since steady_clock epoch, 0 - no task is executing
+			std::atomic<std::chrono::steady_clock::rep> task_start = ATOMIC_VAR_INIT(0);
+			std::array<std::atomic<std::uint64_t>, thread_pool_stats::latency_buckets> queue_wait = {};
+		};
+
+		/// counter updated from any thread, sharded by threads to avoid contention
+		struct alignas(64) counter_shard
+		{
+			std::atomic<std::uint64_t> value = ATOMIC_VAR_INIT(0);
+		};
+
+		static constexpr unsigned counter_shards = 8;
+
 		/// thread worker object, also a future. When thread is finished - future becomes fulfilled
 		class worker : public ext::shared_state_unexceptional<void>
 		{
@@ -98,9 +425,19 @@ namespace ext
 			std::thread m_thread;
 			std::atomic_bool m_stop_request = ATOMIC_VAR_INIT(false);
 
+			// work stealing mode: tasks submitted from this worker thread.
+			// Only owning worker pushes into it, others can only steal
+			std::mutex m_local_mutex;
+			task_list_type m_local_tasks;
+			// size of m_local_tasks, modified under m_local_mutex, read by stats without it
+			std::atomic<std::size_t> m_nlocal = ATOMIC_VAR_INIT(0);
+			// statistics, retired - counters are already accumulated into pool totals
+			worker_counters m_counters;
+			bool m_retired = false;
+
 		private:
 			static void thread_func(ext::intrusive_ptr<worker> self);
-			
+
 		public:
 			bool stop_request() noexcept;
 
@@ -110,21 +447,30 @@ namespace ext
 
 	private:
 		typedef ext::intrusive_ptr<worker> worker_ptr;
-		typedef boost::intrusive::base_hook<hook_type> item_list_option;
 
-		typedef boost::intrusive::list<
-			task_base, item_list_option,
-			boost::intrusive::constant_time_size<false>
-		> task_list_type;
-
-		typedef boost::intrusive::list <
-			delayed_task_continuation, item_list_option,
-			boost::intrusive::constant_time_size<false>
-		> delayed_task_continuation_list;
+		/// worker of current thread, set only in work stealing mode
+		static thread_local worker * ms_current_worker;
 
 	private:
-		// linked list of task
-		task_list_type m_tasks;
+		// operation flags, set at construction
+		const thread_pool_flags m_flags;
+		// memory resource for tasks and delayed continuations, null - global heap
+		std::pmr::memory_resource * const m_resource;
+
+		static constexpr unsigned priority_count = 3;
+		static constexpr std::size_t ring_capacity = 1024;
+		// lockfree_queue mode: ring for normal priority tasks, null otherwise
+		const std::unique_ptr<task_ring> m_ring;
+		// linked lists of tasks, one for each task_priority
+		std::array<task_list_type, priority_count> m_tasks;
+		// number of tasks in high priority lane, read without lock by work stealing workers
+		std::atomic_size_t m_nhigh = ATOMIC_VAR_INIT(0);
+		// number of tasks in all lanes, read without lock by spinning workers
+		std::atomic_size_t m_ntasks = ATOMIC_VAR_INIT(0);
+		// weighted lane draining, see set_priority_weights; strict if not m_weighted
+		bool m_weighted = false;
+		std::array<unsigned, priority_count> m_weights = {};
+		std::array<unsigned, priority_count> m_credits = {};
 
 		// delayed tasks are little tricky, for every one - we create a service continuation,
 		// which when fired, adds task to task_list.
@@ -146,6 +492,8 @@ namespace ext
 		// how many delayed_continuations were not "taken/cancelled" at destruction,
 		// and how many we must wait - it's sort of a semaphore.
 		std::size_t m_delayed_count = 0;
+		// number of continuations in m_delayed
+		std::size_t m_ndelayed = 0;
 
 		// vector of worker objects, it also holds workers that are stopping.
 		// vector is always partitioned by working/stopping:
@@ -154,13 +502,71 @@ namespace ext
 		std::vector<worker_ptr> m_workers;
 		std::size_t m_pending = 0;
 
+		// number of workers parked on m_event, changed only under m_mutex lock,
+		// submitters notify m_event only if there is someone to wake up.
+		// Work stealing mode: pushing into local deque does not lock m_mutex, so it reads it without lock
+		std::atomic_uint m_nsleeping = ATOMIC_VAR_INIT(0);
+		// statistics: submitted counter, abandoned counter, counters accumulated from stopped workers(under m_mutex)
+		std::array<counter_shard, counter_shards> m_nsubmitted;
+		std::atomic<std::uint64_t> m_nabandoned = ATOMIC_VAR_INIT(0);
+		worker_counters m_retired_counters;
+		// workers thread options, see set_affinity, set_thread_name; protected by m_mutex
+		std::vector<unsigned> m_affinity_cpus;
+		thread_pool_affinity m_affinity_mode = thread_pool_affinity::pool_wide;
+		bool m_affinity_configured = false;
+		std::string m_thread_name;
+		// autoscaling controller, see enable_autoscaling.
+		// control mutex serializes enable/disable calls, m_autoscale_mutex/event are used for sleeping/stopping controller
+		std::mutex m_autoscale_control_mutex;
+		std::mutex m_autoscale_mutex;
+		std::condition_variable m_autoscale_event;
+		std::thread m_autoscaler;
+		bool m_autoscale_stop = false;
+		// idle policy, see set_idle_policy
+		unsigned m_spin_count = 0;
+		unsigned m_yield_count = 0;
+
 		mutable std::mutex m_mutex;
 		mutable std::condition_variable m_event;
 
 	private:
 		static bool is_finished(const worker_ptr & wptr) noexcept { return wptr->is_ready(); }
 		static bool join_worker(worker_ptr & wptr);
-		void thread_func(std::atomic_bool & stop_request);
+		void thread_func(worker & self);
+		void stealing_thread_func(worker & self);
+		/// executes task and updates worker statistics, last - time when previous task was finished
+		void execute_task(worker & self, task_base * task, std::chrono::steady_clock::time_point & last) noexcept;
+		/// accumulates counters of stopping worker into pool totals
+		void retire_worker(worker & self) noexcept;
+		/// counts submitted tasks
+		void count_submitted(std::size_t count) noexcept;
+		/// applies affinity and thread name to worker with given index, must be called under m_mutex lock
+		std::error_code apply_thread_options(worker & wrk, std::size_t index) noexcept;
+		/// cpus of worker with given index according to affinity settings, must be called under m_mutex lock
+		std::vector<unsigned> worker_affinity(std::size_t index) const;
+		/// autoscaling controller thread function
+		void autoscale_func(thread_pool_autoscale_options opts);
+		/// stops autoscaling controller, must be called under m_autoscale_control_mutex lock
+		void disable_autoscaling_locked();
+		/// idle worker: spins/yields according to idle policy, waiting for tasks in lanes.
+		/// Called with locked m_mutex, unlocks it while spinning and locks back before return.
+		void idle_spin(std::unique_lock<std::mutex> & lk, const std::atomic_bool & stop_request);
+
+		/// places task into lane of it's priority, must be called under m_mutex lock
+		void enqueue_task(task_base & task) noexcept;
+		/// lockfree_queue mode: takes task from ring without locking, if high lane is empty
+		auto ring_pop() noexcept -> task_base *;
+		/// takes task from lanes according to priority policy, returns nullptr if all lanes are empty.
+		/// must be called under m_mutex lock
+		auto pop_task() noexcept -> task_base *;
+		/// places task into task list(local deque of current worker in work stealing mode) and notifies workers
+		void push_task(task_base * task) noexcept;
+		/// same as push_task, but for a list of count tasks, all of them are placed under single lock
+		void push_tasks(task_list_type & tasks, std::size_t count) noexcept;
+		/// work stealing mode: steals task from deque of some other worker, must be called under m_mutex lock
+		auto steal_task(worker & self) noexcept -> task_base *;
+		/// work stealing mode: moves tasks from deque of worker into shared list, must be called under m_mutex lock
+		void flush_local_tasks(worker & wrk) noexcept;
 
 	public: // execution control
 		/// returns current number of workers
@@ -177,6 +583,39 @@ namespace ext
 		/// are completely stopped.
 		ext::future<void> stop() { return set_nworkers(0); }
 
+		/// sets weights for weighted round robin draining of priority lanes, see thread_pool description.
+		/// If all weights are 0 - lanes are drained strictly by priority(default).
+		void set_priority_weights(unsigned high, unsigned normal, unsigned background);
+
+		/// sets idle policy of workers: before parking idle worker spins nspins times checking for new tasks,
+		/// than yields nyields times. By default both are 0 - worker is parked immediately.
+		void set_idle_policy(unsigned nspins, unsigned nyields);
+		/// returns number of workers currently parked waiting for tasks
+		unsigned get_nparked() const noexcept { return m_nsleeping.load(std::memory_order_relaxed); }
+
+		/// pins workers to cpus, see thread_pool_affinity. Empty cpus set removes pinning(workers can run on any cpu of process).
+		/// Applied to running workers immediately and to workers created later by set_nworkers.
+		/// Throws std::system_error if cpus contains cpu not allowed for process or affinity is not supported by platform,
+		/// nothing is changed then. If setting affinity of some running worker fails - it's still applied to others
+		/// and std::system_error with first error is thrown. For workers created later errors are ignored.
+		void set_affinity(std::vector<unsigned> cpus, thread_pool_affinity mode = thread_pool_affinity::pool_wide);
+		/// names worker threads as prefix + worker index, on linux name is limited to 15 characters:
+		/// prefix is truncated, index is always kept.
+		/// Applied to running workers immediately and to workers created later by set_nworkers.
+		/// On platforms without thread naming support does nothing
+		void set_thread_name(std::string prefix);
+
+		/// starts background controller, which every opts.interval looks at statistics and:
+		///  * adds workers if tasks wait in queue for too long(each time by quarter of current number, at least one);
+		///  * stops one worker if workers are mostly idle.
+		/// Number of workers is kept within [opts.min_workers, opts.max_workers], current number is clamped immediately.
+		/// Stopped workers are stopped same way as by set_nworkers.
+		/// If autoscaling is already enabled - it's restarted with new options.
+		/// Throws std::invalid_argument if min_workers > max_workers or max_workers == 0
+		void enable_autoscaling(const thread_pool_autoscale_options & opts);
+		/// stops autoscaling controller, number of workers is left as is
+		void disable_autoscaling();
+
 	public: // job control
 		/// submits task for execution, returns future representing result of execution.
 		template <class Functor, class ... Args>
@@ -187,13 +626,63 @@ namespace ext
 		auto submit(Future future, Functor && func, Args && ... args) ->
 			ext::future<std::invoke_result_t<std::decay_t<Functor>, std::enable_if_t<is_future_type_v<Future>, Future>, std::decay_t<Args>...>>;
 
+		/// same as submit, but task is placed into lane of given priority
+		template <class Functor, class ... Args>
+		auto submit(task_priority prio, Functor && func, Args && ... args) ->
+		    ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>;
+
+		template <class Future, class Functor, class ... Args>
+		auto submit(task_priority prio, Future future, Functor && func, Args && ... args) ->
+			ext::future<std::invoke_result_t<std::decay_t<Functor>, std::enable_if_t<is_future_type_v<Future>, Future>, std::decay_t<Args>...>>;
+
+		/// same as submit, but task is linked with stop token(see ext::cancel_on_stop):
+		///  * if stop is requested before task is started - task is cancelled, functor is never called,
+		///    worker drops such task when takes it from queue;
+		///  * if functor accepts stop_token as first argument - it's called as func(token, args...),
+		///    so running task can poll token and finish early.
+		template <class Functor, class ... Args>
+		auto submit(ext::stop_token token, Functor && func, Args && ... args) ->
+			ext::future<ext::invoke_with_stop_token_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>;
+
+		template <class Functor, class ... Args>
+		auto submit(task_priority prio, ext::stop_token token, Functor && func, Args && ... args) ->
+			ext::future<ext::invoke_with_stop_token_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>;
+
+		/// submits func(elem) for every element of [first, last) as separate task, elements are copied into tasks.
+		/// Functor is shared by all tasks and can be called concurrently.
+		/// All task objects are allocated in one block and are placed into task list under single lock.
+		/// Returns futures for each submitted task in order of elements.
+		template <class ForwardIterator, class Functor>
+		auto submit_bulk(ForwardIterator first, ForwardIterator last, Functor && func) ->
+			std::vector<ext::future<std::invoke_result_t<std::decay_t<Functor> &, typename std::iterator_traits<ForwardIterator>::value_type>>>;
+
+		/// splits range into chunks of grain elements and submits each chunk as a task,
+		/// chunk task calls func(elem) for every element of it's part of range.
+		/// Functor is shared by all chunks and can be called concurrently.
+		/// Returns future which becomes ready when all chunks are executed:
+		///  * if any call throws - future holds first exception, chunks not yet started are skipped;
+		///  * if future is cancelled - chunks not yet started are skipped;
+		///  * if some chunks were abandoned(see clear) - future becomes abandoned.
+		/// Rvalue range is moved into shared state, lvalue range is referenced and must live until future becomes ready.
+		template <class Range, class Functor>
+		ext::future<void> parallel_for(Range && range, std::size_t grain, Functor && func);
+
 		/// clears all not already executed tasks.
 		/// Associated futures status become abandoned
 		void clear() noexcept;
 
 	public:
-		// 0 means 0, no workers at all, you must explicitly set number you want
-		thread_pool(unsigned nworkers = 0);
+		/// returns operation flags this thread_pool was constructed with
+		thread_pool_flags flags() const noexcept { return m_flags; }
+		/// returns snapshot of runtime statistics
+		thread_pool_stats stats() const;
+		/// returns memory resource tasks are allocated from, null if tasks are allocated from global heap
+		std::pmr::memory_resource * memory_resource() const noexcept { return m_resource; }
+
+	public:
+		// 0 means 0, no workers at all, you must explicitly set number you want.
+		// resource, if not null, is used for allocating tasks(see task_memory_resource), must outlive thread_pool
+		thread_pool(unsigned nworkers = 0, thread_pool_flags flags = thread_pool_flags::none, std::pmr::memory_resource * resource = nullptr);
 		~thread_pool() noexcept;
 
 		thread_pool(thread_pool &&) = delete;
@@ -204,7 +693,21 @@ namespace ext
 	};
 
 	template <class Functor, class ... Args>
-	auto thread_pool::submit(Functor && func, Args && ... args) ->
+	inline auto thread_pool::submit(Functor && func, Args && ... args) ->
+		ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>
+	{
+		return submit(task_priority::normal, std::forward<Functor>(func), std::forward<Args>(args)...);
+	}
+
+	template <class Future, class Functor, class ... Args>
+	inline auto thread_pool::submit(Future future, Functor && func, Args && ... args) ->
+		ext::future<std::invoke_result_t<std::decay_t<Functor>, std::enable_if_t<is_future_type_v<Future>, Future>, std::decay_t<Args>...>>
+	{
+		return submit(task_priority::normal, std::move(future), std::forward<Functor>(func), std::forward<Args>(args)...);
+	}
+
+	template <class Functor, class ... Args>
+	auto thread_pool::submit(task_priority prio, Functor && func, Args && ... args) ->
 		ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>
 	{
 		using result_type = std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>;
@@ -219,20 +722,16 @@ namespace ext
 		using task_type = task_impl<functor_type, result_type>;
 		using future_type = ext::future<result_type>;
 		
-		auto task = ext::make_intrusive<task_type>(std::move(closure));
+		auto task = ext::make_pmr_intrusive<task_type>(m_resource, std::move(closure));
+		task->m_priority = prio;
 		future_type fut {task};
 
-		{
-			std::lock_guard lk(m_mutex);
-			m_tasks.push_back(*task.release());
-		}
-
-		m_event.notify_one();
+		push_task(task.release());
 		return fut;
 	}
 
 	template <class Future, class Functor, class ... Args>
-	auto thread_pool::submit(Future future, Functor && func, Args && ... args) ->
+	auto thread_pool::submit(task_priority prio, Future future, Functor && func, Args && ... args) ->
 		ext::future<std::invoke_result_t<std::decay_t<Functor>, std::enable_if_t<is_future_type_v<Future>, Future>, std::decay_t<Args>...>>
 	{
 		static_assert(ext::is_future_type_v<Future>);
@@ -249,32 +748,255 @@ namespace ext
 		using task_type = task_impl<functor_type, result_type>;
 		using future_type = ext::future<result_type>;
 
-		auto task = ext::make_intrusive<task_type>(std::move(closure));
+		auto task = ext::make_pmr_intrusive<task_type>(m_resource, std::move(closure));
+		task->m_priority = prio;
 		future_type fut {task};
 
+		// deferred future - make it ready
 		if (handle->is_deferred())
-		{	// make it ready
 			handle->wait();
 
-			{
-				std::lock_guard lk(m_mutex);
-				m_tasks.push_back(*task.release());
-			}
-
-			m_event.notify_one();
+		if (handle->is_ready())
+		{	// fast path: no need for continuation and delayed bookkeeping
+			push_task(task.release());
 		}
 		else
 		{
-			auto cont = ext::make_intrusive<delayed_task_continuation>(this, std::move(task));
+			auto cont = ext::make_pmr_intrusive<delayed_task_continuation>(m_resource, this, std::move(task));
 
 			{
 				std::lock_guard lk(m_mutex);
 				m_delayed.push_back((cont.addref(), *cont.get()));
+				++m_ndelayed;
 			}
 
+			count_submitted(1);
+
 			handle->add_continuation(cont.get());
 		}
 		
 		return fut;
 	}
+
+	template <class Functor, class ... Args>
+	inline auto thread_pool::submit(ext::stop_token token, Functor && func, Args && ... args) ->
+		ext::future<ext::invoke_with_stop_token_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>
+	{
+		return submit(task_priority::normal, std::move(token), std::forward<Functor>(func), std::forward<Args>(args)...);
+	}
+
+	template <class Functor, class ... Args>
+	auto thread_pool::submit(task_priority prio, ext::stop_token token, Functor && func, Args && ... args) ->
+		ext::future<ext::invoke_with_stop_token_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>
+	{
+		using result_type = ext::invoke_with_stop_token_result_t<std::decay_t<Functor>, std::decay_t<Args>...>;
+
+		auto closure = [token, func = std::forward<Functor>(func),
+		                args_tuple = std::make_tuple(std::forward<Args>(args)...)]() mutable -> result_type
+		{
+			return ext::apply([&func, &token](auto && ... args) -> result_type
+			{
+				return ext::invoke_with_stop_token(std::move(func), token, std::forward<decltype(args)>(args)...);
+			}, std::move(args_tuple));
+		};
+
+		auto fut = submit(prio, std::move(closure));
+		// task can be already taken by worker, then it's not cancellable anymore and can only poll token
+		ext::cancel_on_stop(fut, token);
+		return fut;
+	}
+
+	template <class ForwardIterator, class Functor>
+	auto thread_pool::submit_bulk(ForwardIterator first, ForwardIterator last, Functor && func) ->
+		std::vector<ext::future<std::invoke_result_t<std::decay_t<Functor> &, typename std::iterator_traits<ForwardIterator>::value_type>>>
+	{
+		using arg_type = typename std::iterator_traits<ForwardIterator>::value_type;
+		using functor_type = std::decay_t<Functor>;
+		using result_type = std::invoke_result_t<functor_type &, arg_type>;
+		using closure_type = bulk_closure<functor_type, arg_type>;
+		using task_type = bulk_task_impl<closure_type, result_type>;
+		using block_type = bulk_block<task_type, functor_type>;
+		using future_type = ext::future<result_type>;
+
+		std::vector<future_type> futures;
+		auto count = static_cast<std::size_t>(std::distance(first, last));
+		if (count == 0) return futures;
+
+		futures.reserve(count);
+		auto * block = block_type::create(m_resource, functor_type(std::forward<Functor>(func)), count);
+		task_list_type tasks;
+
+		try
+		{
+			for (auto * ptr = block->m_tasks; first != last; ++first, ++ptr)
+			{
+				auto * task = new (ptr) task_type(block, closure_type {&block->m_func, *first});
+				block->task_acquired();
+
+				tasks.push_back(*task);
+				futures.emplace_back(ext::intrusive_ptr<shared_state_basic>(task));
+			}
+		}
+		catch (...)
+		{
+			tasks.clear_and_dispose([](task_base * task) { task->task_release(); });
+			futures.clear();
+			block->task_released();
+			throw;
+		}
+
+		// block is filled, from now on it's lifetime is managed by tasks
+		block->task_released();
+		push_tasks(tasks, count);
+
+		return futures;
+	}
+
+	template <class Range, class Functor>
+	ext::future<void> thread_pool::parallel_for(Range && range, std::size_t grain, Functor && func)
+	{
+		using state_type = parallel_for_task<Range, std::decay_t<Functor>>;
+		if (grain == 0) grain = 1;
+
+		auto state = ext::make_pmr_intrusive<state_type>(m_resource, m_resource, std::forward<Range>(range), std::forward<Functor>(func));
+		auto first = std::begin(state->m_range);
+		auto last  = std::end(state->m_range);
+
+		auto size = static_cast<std::size_t>(std::distance(first, last));
+		if (size == 0)
+		{
+			state->set_value();
+			return {std::move(state)};
+		}
+
+		auto nchunks = (size + grain - 1) / grain;
+		auto & chunks = state->m_chunks;
+		chunks.reserve(nchunks);
+
+		task_list_type tasks;
+		for (; size > grain; size -= grain)
+		{
+			auto chunk_last = std::next(first, grain);
+			tasks.push_back(chunks.emplace_back(state.get(), first, chunk_last));
+			first = chunk_last;
+		}
+
+		tasks.push_back(chunks.emplace_back(state.get(), first, last));
+
+		// every queued chunk holds a reference to state
+		state->m_count.store(nchunks, std::memory_order_relaxed);
+		state->addref(static_cast<unsigned>(nchunks));
+		push_tasks(tasks, nchunks);
+
+		return {std::move(state)};
+	}
+
+	inline void thread_pool::bulk_block_base::task_released() noexcept
+	{
+		if (m_refs.fetch_sub(1, std::memory_order_release) == 1)
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			destroy();
+		}
+	}
+
+	template <class Task, class Functor>
+	thread_pool::bulk_block<Task, Functor>::bulk_block(std::pmr::memory_resource * resource, Functor func, std::size_t count)
+		: m_resource(resource), m_func(std::move(func)), m_count(count)
+	{
+		if (count > (std::numeric_limits<std::size_t>::max)() / sizeof(Task))
+			throw std::bad_array_new_length();
+
+		m_tasks = static_cast<Task *>(m_resource->allocate(sizeof(Task) * count, alignof(Task)));
+	}
+
+	template <class Task, class Functor>
+	thread_pool::bulk_block<Task, Functor>::~bulk_block()
+	{
+		m_resource->deallocate(m_tasks, sizeof(Task) * m_count, alignof(Task));
+	}
+
+	template <class Task, class Functor>
+	auto thread_pool::bulk_block<Task, Functor>::create(std::pmr::memory_resource * resource, Functor func, std::size_t count) -> bulk_block *
+	{
+		if (not resource) resource = std::pmr::new_delete_resource();
+		void * ptr = resource->allocate(sizeof(bulk_block), alignof(bulk_block));
+
+		try
+		{
+			return new (ptr) bulk_block(resource, std::move(func), count);
+		}
+		catch (...)
+		{
+			resource->deallocate(ptr, sizeof(bulk_block), alignof(bulk_block));
+			throw;
+		}
+	}
+
+	template <class Task, class Functor>
+	void thread_pool::bulk_block<Task, Functor>::destroy() noexcept
+	{
+		auto * resource = m_resource;
+		this->~bulk_block();
+		resource->deallocate(this, sizeof(bulk_block), alignof(bulk_block));
+	}
+
+	template <class Functor, class ResultType>
+	unsigned thread_pool::bulk_task_impl<Functor, ResultType>::release() noexcept
+	{
+		// same as shared_state_basic::release, but memory belongs to block
+		auto ref = this->m_refs.fetch_sub(1, std::memory_order_release);
+		if (ref == 1)
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			auto * block = m_block;
+			this->~bulk_task_impl();
+			block->task_released();
+		}
+
+		return --ref;
+	}
+
+	template <class Range, class Functor>
+	void thread_pool::parallel_for_task<Range, Functor>::execute_chunk(iterator first, iterator last) noexcept
+	{
+		// whole task is cancelled or already failed - there is no sense to continue
+		if (this->is_pending() and not m_failed.load(std::memory_order_relaxed))
+		{
+			try
+			{
+				for (; first != last; ++first)
+					ext::invoke(m_func, *first);
+			}
+			catch (...)
+			{
+				if (not m_failed.exchange(true, std::memory_order_relaxed))
+					m_error = std::current_exception();
+			}
+		}
+
+		chunk_finished();
+	}
+
+	template <class Range, class Functor>
+	void thread_pool::parallel_for_task<Range, Functor>::chunk_abandoned() noexcept
+	{
+		m_abandoned.store(true, std::memory_order_relaxed);
+		chunk_finished();
+	}
+
+	template <class Range, class Functor>
+	void thread_pool::parallel_for_task<Range, Functor>::chunk_finished() noexcept
+	{
+		// acq_rel: last chunk must see m_error and flags set by other chunks
+		if (m_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+
+		if (m_abandoned.load(std::memory_order_relaxed))
+			this->release_promise();
+		else if (m_failed.load(std::memory_order_relaxed))
+			this->set_exception(std::move(m_error));
+		else
+			this->set_value();
+	}
 }
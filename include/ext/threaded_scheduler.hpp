@@ -1,17 +1,60 @@
 ﻿#pragma once
-#include <queue>
+#include <cstddef>
 #include <atomic>
+#include <memory>
+#include <vector>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
+#include <stdexcept>
+#include <boost/intrusive/list.hpp>
 #include <ext/intrusive_ptr.hpp>
 #include <ext/future.hpp>
+#include <ext/task_memory_resource.hpp>
 
 namespace ext
 {
-	/// scheduler implementation via background thread with priority_queue.
+	class thread_pool;
+
+	/// timer queue implementation used by threaded_scheduler
+	enum class scheduler_backend : unsigned
+	{
+		/// binary heap: O(log n) insert, pop and cancel, exact ordering
+		heap,
+		/// hierarchical timing wheel: O(1) insert and cancel, O(1) amortized expiry.
+		/// Time is rounded up to tick resolution, tasks expiring in same tick are executed in submission order
+		timer_wheel,
+	};
+
+	/// how periodic task time points are computed, see threaded_scheduler::submit_periodic
+	enum class periodic_mode : unsigned
+	{
+		/// runs are aligned to first time point + n * interval, regardless of execution time.
+		/// If runs are missed(execution took longer than interval) - they are skipped, not executed in a burst
+		fixed_rate,
+		/// next run is interval after previous run completes
+		fixed_delay,
+	};
+
+	/// construction options of threaded_scheduler
+	struct threaded_scheduler_options
+	{
+		scheduler_backend backend = scheduler_backend::heap;
+		/// timer_wheel backend: tick resolution, task is executed not earlier than it's time point, but can be late up to tick
+		std::chrono::steady_clock::duration tick = std::chrono::milliseconds(1);
+		/// memory resource for tasks(see task_memory_resource), null - global heap
+		std::pmr::memory_resource * resource = nullptr;
+		/// if not null - expired tasks are executed on this thread_pool, instead of scheduler thread.
+		/// Tasks expired on one wake-up are submitted as one batch(see thread_pool::submit_bulk).
+		/// thread_pool must outlive threaded_scheduler
+		thread_pool * executor = nullptr;
+	};
+
+	/// scheduler implementation via background thread with timer queue(binary heap or timing wheel).
+	/// Expired tasks are executed either by background thread itself, or are handed to executor(thread_pool), see threaded_scheduler_options.
 	/// Task can be submitted via submit method.
 	/// For every task result of execution can be retrieved via associated future.
+	/// Cancelling future of pending task unlinks it from timer queue immediately, resources are released right away.
 	/// 
 	/// All methods are thread-safe
 	class threaded_scheduler
@@ -21,10 +64,23 @@ namespace ext
 		typedef std::chrono::steady_clock::duration   duration;
 
 	private:
-		class task_base
+		typedef boost::intrusive::list_base_hook<
+			boost::intrusive::link_mode<boost::intrusive::link_mode_type::normal_link>
+		> hook_type;
+
+		class task_base : public hook_type
 		{
 		public:
 			time_point point;
+			/// owner scheduler, used on cancellation for unlinking task from timer queue
+			threaded_scheduler * owner;
+			/// position of task in timer queue(heap index or wheel slot), maintained by queue under m_mutex
+			std::size_t index = 0;
+			/// task is in timer queue, protected by m_mutex
+			bool linked = false;
+			/// right of unlinking task from timer queue: taken either by cancel or by scheduler, whoever comes first.
+			/// If scheduler takes task out of queue and cancel already took it - cancel is in flight, see m_ncancelling
+			std::atomic_bool queued = ATOMIC_VAR_INIT(false);
 
 		public:
 			virtual ~task_base() = default;
@@ -36,6 +92,10 @@ namespace ext
 			virtual void task_release()  noexcept = 0;
 			virtual void task_abandone() noexcept = 0;
 			virtual void task_execute()  noexcept = 0;
+			/// periodic tasks: called after execution, computes next time point, returns false if task is finished
+			virtual bool task_reschedule() noexcept { return false; }
+			/// periodic tasks: task is still running(not cancelled, not failed)
+			virtual bool task_pending() const noexcept { return false; }
 
 		public:
 			friend inline void intrusive_ptr_add_ref(task_base * ptr) noexcept { ptr->task_addref(); }
@@ -52,13 +112,16 @@ namespace ext
 
 		public:
 			void task_addref()   noexcept override { base_type::addref(); }
-			void task_release()  noexcept override { base_type::release(); }
+			// release is virtual, task can be pmr_allocated
+			void task_release()  noexcept override { this->release(); }
 			void task_abandone() noexcept override { base_type::release_promise(); }
 			void task_execute()  noexcept override { base_type::execute(); }
 
+			bool cancel() noexcept override;
+
 		public:
-			task_impl(time_point tp, Functor func)
-				: base_type(std::move(func)) { task_base::point = tp; }
+			task_impl(threaded_scheduler * owner, time_point tp, Functor func)
+				: base_type(std::move(func)) { task_base::point = tp; task_base::owner = owner; }
 
 		public:
 			friend inline void intrusive_ptr_add_ref(task_impl * ptr) noexcept { ptr->addref(); }
@@ -66,36 +129,101 @@ namespace ext
 			friend inline void intrusive_ptr_use_count(const task_impl * ptr) noexcept {}
 		};
 		
+		/// periodic task: one object for all runs, after execution it's placed back into timer queue.
+		/// Associated future becomes ready only when recurrence is stopped: cancelled, functor has thrown or task was abandoned
+		template <class Functor>
+		class periodic_task :
+			public task_base,
+			public ext::shared_state<void>
+		{
+			typedef ext::shared_state<void> base_type;
+
+		private:
+			Functor m_functor;
+			duration m_interval;
+			periodic_mode m_mode;
+
+		public:
+			void task_addref()   noexcept override { base_type::addref(); }
+			void task_release()  noexcept override { this->release(); }
+			void task_abandone() noexcept override { base_type::release_promise(); }
+			void task_execute()  noexcept override;
+			bool task_reschedule() noexcept override;
+			bool task_pending() const noexcept override { return base_type::is_pending(); }
+
+			bool cancel() noexcept override;
+
+		public:
+			periodic_task(threaded_scheduler * owner, time_point first, duration interval, periodic_mode mode, Functor func)
+				: m_functor(std::move(func)), m_interval(interval), m_mode(mode)
+			{ task_base::point = first; task_base::owner = owner; }
+
+		public:
+			friend inline void intrusive_ptr_add_ref(periodic_task * ptr) noexcept { ptr->addref(); }
+			friend inline void intrusive_ptr_release(periodic_task * ptr) noexcept { ptr->release(); }
+			friend inline void intrusive_ptr_use_count(const periodic_task * ptr) noexcept {}
+		};
+
 		typedef ext::intrusive_ptr<task_base> task_ptr;
 
-		class entry_comparer
+		/// abstract timer queue, all methods are called under m_mutex lock
+		class timer_queue
 		{
 		public:
-			typedef bool result_type;
-			bool operator()(const task_ptr & t1, const task_ptr & t2) const noexcept;
+			virtual ~timer_queue() = default;
+
+			/// places task into queue
+			virtual void push(task_ptr task) = 0;
+			/// takes task with point <= now, returns null if there is no such task
+			virtual task_ptr pop(time_point now) = 0;
+			/// time point when scheduler thread should check queue again, can be earlier than next task point
+			virtual time_point next_point() const = 0;
+			/// moves all tasks into tasks
+			virtual void take_all(std::vector<task_ptr> & tasks) = 0;
+			/// unlinks given task from queue, returns reference queue was holding
+			virtual task_ptr remove(task_base & task) noexcept = 0;
 		};
 
-	private:
-		typedef std::priority_queue<
-			task_ptr,
-			std::deque<task_ptr>,
-			entry_comparer
-		> queue_type;
+		class heap_queue;
+		class wheel_queue;
+
+		class pooled_task;
+		class pooled_batch;
 
 	private:
-		queue_type m_queue;
+		std::unique_ptr<timer_queue> m_queue;
 		std::thread m_thread;
 		bool m_stopped = false;
+		// time point scheduler thread sleeps until, min - thread is awake.
+		// Submitting task later than it does not wake up the thread
+		time_point m_wait_point = time_point::min();
+		// number of cancellations in flight: task was taken out of queue, while concurrent cancel is going to unlink it.
+		// Destructor waits until they complete
+		std::size_t m_ncancelling = 0;
+		// executor for expired tasks, null - tasks are executed by m_thread
+		thread_pool * const m_executor;
+		// number of batches submitted into executor and not yet destroyed, destructor waits until they complete
+		std::size_t m_nbatches = 0;
+		// memory resource for tasks, null - global heap
+		std::pmr::memory_resource * const m_resource;
 
 		mutable std::mutex m_mutex;
 		mutable std::condition_variable m_newdata;
 
 	private:
+		static time_point coalesce(time_point tp, duration slack) noexcept;
+
 		void thread_func();
 		void run_passed_events();
 
-		template <class Lock>
-		time_point next_in(Lock & lk) const noexcept;
+		bool enqueue(task_ptr task);
+		bool requeue(task_ptr & task) noexcept;
+		void unqueue(task_base & task) noexcept;
+		void unqueue_all(std::vector<task_ptr> & tasks) noexcept;
+		void cancel_task(task_base & task) noexcept;
+		void execute_pooled(task_ptr task) noexcept;
+		void batch_finished() noexcept;
+		bool drained() const noexcept { return m_ncancelling == 0 and m_nbatches == 0; }
 
 	public:
 		template <class Functor, class ... Args>
@@ -105,11 +233,44 @@ namespace ext
 		template <class Functor, class ... Args>
 		auto submit(duration  rel, Functor && func, Args && ... args) ->
 			ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>;
+
+		/// same as submit, but task is allowed to be executed later up to slack.
+		/// Time point is rounded up to coarse boundary within [tp, tp + slack](power of 2 granularity),
+		/// so tasks with close time points expire together on one scheduler wake-up. Useful for large number of timeouts.
+		template <class Functor, class ... Args>
+		auto submit_with_slack(time_point tp, duration slack, Functor && func, Args && ... args) ->
+			ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>;
+
+		template <class Functor, class ... Args>
+		auto submit_with_slack(duration  rel, duration slack, Functor && func, Args && ... args) ->
+			ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>;
 		
+		/// submits functor for periodic execution: first at first time point, than every interval according to mode.
+		/// Task object is reused for all runs. Functor result, if any, is ignored.
+		/// Returned future is a handle of recurrence: cancel stops it(pending run is unlinked immediately, current run is not interrupted).
+		/// Future becomes ready only when recurrence is stopped: cancelled, holds exception thrown by functor, or abandoned by clear/destruction.
+		/// throws std::invalid_argument if interval is not positive
+		template <class Functor>
+		auto submit_periodic(time_point first, duration interval, Functor && func, periodic_mode mode = periodic_mode::fixed_rate) -> ext::future<void>;
+
+		template <class Functor>
+		auto submit_periodic(duration interval, Functor && func, periodic_mode mode = periodic_mode::fixed_rate) -> ext::future<void>;
+
+		/// abandons all pending tasks, including periodic ones.
+		/// Periodic task running at the moment of call is not affected and continues recurrence
 		void clear() noexcept;
 
+		/// returns memory resource tasks are allocated from, null if tasks are allocated from global heap
+		std::pmr::memory_resource * memory_resource() const noexcept { return m_resource; }
+		/// returns thread_pool expired tasks are executed on, null if they are executed by scheduler thread
+		thread_pool * executor() const noexcept { return m_executor; }
+
 	public:
-		threaded_scheduler();
+		/// resource, if not null, is used for allocating tasks(see task_memory_resource), must outlive threaded_scheduler.
+		/// It can be shared with thread_pool
+		explicit threaded_scheduler(std::pmr::memory_resource * resource = nullptr);
+		explicit threaded_scheduler(const threaded_scheduler_options & opts);
+		/// destructor waits until tasks already handed to executor are executed or abandoned by it
 		~threaded_scheduler() noexcept;
 
 		threaded_scheduler(threaded_scheduler &&) = delete;
@@ -134,22 +295,133 @@ namespace ext
 		using task_type = task_impl<functor_type, result_type>;
 		using future_type = ext::future<result_type>;
 
-		auto task = ext::make_intrusive<task_type>(tp, std::move(closure));
+		auto task = ext::make_pmr_intrusive<task_type>(m_resource, this, tp, std::move(closure));
 		future_type fut {task};
 
+		bool notify;
 		{
 			std::lock_guard lk(m_mutex);
-			m_queue.push(std::move(task));
+			notify = enqueue(std::move(task));
 		}
-		
-		m_newdata.notify_one();
+
+		if (notify) m_newdata.notify_one();
 		return fut;
 	}
 
+	template <class Functor, class ResultType>
+	bool threaded_scheduler::task_impl<Functor, ResultType>::cancel() noexcept
+	{
+		if (not base_type::cancel())
+			return false;
+
+		// if scheduler still holds the task - unlink it right now, instead of waiting for it's time point
+		if (task_base::queued.exchange(false, std::memory_order_acq_rel))
+			task_base::owner->cancel_task(*this);
+
+		return true;
+	}
+
+	template <class Functor>
+	void threaded_scheduler::periodic_task<Functor>::task_execute() noexcept
+	{
+		// cancelled while waiting in ready list
+		if (not base_type::is_pending())
+			return;
+
+		EXT_FUTURE_TRACE_EXECUTION(this);
+		try
+		{
+			m_functor();
+		}
+		catch (...)
+		{
+			// can be cancelled concurrently, set_exception does nothing in that case
+			try { base_type::set_exception(std::current_exception()); }
+			catch (ext::future_error &) {}
+		}
+	}
+
+	template <class Functor>
+	bool threaded_scheduler::periodic_task<Functor>::task_reschedule() noexcept
+	{
+		if (not base_type::is_pending())
+			return false;
+
+		auto now = time_point::clock::now();
+		auto & point = task_base::point;
+
+		if (m_mode == periodic_mode::fixed_delay)
+			point = now + m_interval;
+		else
+		{
+			// stay aligned to original schedule, this does not accumulate drift
+			point += m_interval;
+			if (point <= now)
+				point += m_interval * ((now - point) / m_interval + 1);
+		}
+
+		return true;
+	}
+
+	template <class Functor>
+	bool threaded_scheduler::periodic_task<Functor>::cancel() noexcept
+	{
+		if (not base_type::cancel())
+			return false;
+
+		// pairs with fence in threaded_scheduler::requeue: either we see task queued, or scheduler sees it cancelled
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (task_base::queued.exchange(false, std::memory_order_acq_rel))
+			task_base::owner->cancel_task(*this);
+
+		return true;
+	}
+
+	template <class Functor>
+	auto threaded_scheduler::submit_periodic(time_point first, duration interval, Functor && func, periodic_mode mode) -> ext::future<void>
+	{
+		if (interval <= duration::zero())
+			throw std::invalid_argument("ext::threaded_scheduler::submit_periodic: interval must be positive");
+
+		using task_type = periodic_task<std::decay_t<Functor>>;
+
+		auto task = ext::make_pmr_intrusive<task_type>(m_resource, this, first, interval, mode, std::forward<Functor>(func));
+		ext::future<void> fut {task};
+
+		bool notify;
+		{
+			std::lock_guard lk(m_mutex);
+			notify = enqueue(std::move(task));
+		}
+
+		if (notify) m_newdata.notify_one();
+		return fut;
+	}
+
+	template <class Functor>
+	inline auto threaded_scheduler::submit_periodic(duration interval, Functor && func, periodic_mode mode) -> ext::future<void>
+	{
+		return submit_periodic(time_point::clock::now() + interval, interval, std::forward<Functor>(func), mode);
+	}
+
 	template <class Functor, class ... Args>
 	inline auto threaded_scheduler::submit(duration rel, Functor && func, Args && ... args) ->
 		ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>
 	{
 		return submit(rel + time_point::clock::now(), std::forward<Functor>(func), std::forward<Args>(args)...);
 	}
+
+	template <class Functor, class ... Args>
+	inline auto threaded_scheduler::submit_with_slack(time_point tp, duration slack, Functor && func, Args && ... args) ->
+		ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>
+	{
+		return submit(coalesce(tp, slack), std::forward<Functor>(func), std::forward<Args>(args)...);
+	}
+
+	template <class Functor, class ... Args>
+	inline auto threaded_scheduler::submit_with_slack(duration rel, duration slack, Functor && func, Args && ... args) ->
+		ext::future<std::invoke_result_t<std::decay_t<Functor>, std::decay_t<Args>...>>
+	{
+		return submit_with_slack(rel + time_point::clock::now(), slack, std::forward<Functor>(func), std::forward<Args>(args)...);
+	}
 }
@@ -0,0 +1,24 @@
+#pragma once
+// internal header of extlib sources, not installed
+#include <boost/predef.h>
+
+#if BOOST_COMP_MSVC and (BOOST_ARCH_X86 or BOOST_ARCH_ARM)
+#include <intrin.h>
+#endif
+
+namespace ext
+{
+	/// cpu hint for spin-wait loops
+	inline void cpu_relax() noexcept
+	{
+	#if BOOST_COMP_MSVC and BOOST_ARCH_X86
+		_mm_pause();
+	#elif BOOST_COMP_MSVC and BOOST_ARCH_ARM
+		__yield();
+	#elif BOOST_ARCH_X86
+		__builtin_ia32_pause();
+	#elif BOOST_ARCH_ARM
+		asm volatile("yield");
+	#endif
+	}
+}
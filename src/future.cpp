@@ -6,6 +6,16 @@
 #include <ext/future.hpp>
 #include <vector>
 #include <thread>
+#include <boost/predef.h>
+#include "cpu_relax.hpp"
+
+#if BOOST_OS_LINUX
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 namespace ext
 {
@@ -71,6 +81,54 @@ namespace ext
 	static continuation_waiter * acquire_waiter();
 	static void release_waiter(continuation_waiter * ptr) noexcept;
 
+
+#ifdef EXT_FUTURE_TRACING
+	static std::atomic<future_tracer *> g_tracer = ATOMIC_VAR_INIT(nullptr);
+	static std::atomic<std::uint64_t> g_trace_id = ATOMIC_VAR_INIT(0);
+
+	void set_future_tracer(future_tracer * tracer) noexcept
+	{
+		g_tracer.store(tracer, std::memory_order_release);
+	}
+
+	future_tracer * get_future_tracer() noexcept
+	{
+		return g_tracer.load(std::memory_order_acquire);
+	}
+
+	shared_state_basic::shared_state_basic() noexcept
+		: m_trace_id(g_trace_id.fetch_add(1, std::memory_order_relaxed) + 1)
+	{
+		if (auto * tracer = get_future_tracer())
+			tracer->created(this);
+	}
+#endif
+
+	static inline void trace_satisfied(const shared_state_basic * state, future_state reason) noexcept
+	{
+	#ifdef EXT_FUTURE_TRACING
+		if (auto * tracer = get_future_tracer())
+			tracer->satisfied(state, reason);
+	#endif
+	}
+
+	/// runs continuation, with tracer notification if tracing is enabled
+	static inline void run_continuation(shared_state_basic * continuation, shared_state_basic * caller) noexcept
+	{
+	#ifdef EXT_FUTURE_TRACING
+		if (auto * tracer = get_future_tracer())
+		{
+			// continuation is referenced by caller for the time of continuate call
+			tracer->continuation_started(caller, continuation);
+			continuation->continuate(caller);
+			tracer->continuation_finished(caller, continuation);
+			return;
+		}
+	#endif
+
+		continuation->continuate(caller);
+	}
+
 	std::uintptr_t shared_state_basic::lock_ptr(std::atomic_uintptr_t & ptr) noexcept
 	{
 		// lock head
@@ -133,7 +191,7 @@ namespace ext
 		auto fstate = lock_ptr(head);
 		if (fstate == ready)
 		{   // state became ready. just execute continuation.
-			continuation->continuate(caller); // it's defined as noexcept
+			run_continuation(continuation, caller); // it's defined as noexcept
 			return false;
 		}
 
@@ -176,7 +234,7 @@ namespace ext
 		do
 		{
 			addr = ptr->m_fstnext.load(std::memory_order_acquire);
-			ptr->continuate(caller);
+			run_continuation(ptr, caller);
 			ptr->release();
 
 		loop:
@@ -291,6 +349,8 @@ namespace ext
 			newval = (previous & ~status_mask) | static_cast<unsigned>(reason);
 
 		} while (not m_promise_state.compare_exchange_weak(previous, newval, std::memory_order_relaxed));
+
+		trace_satisfied(this, reason);
 		return true;
 	}
 
@@ -318,6 +378,8 @@ namespace ext
 			newval = (previous & ~status_mask) | static_cast<unsigned>(reason);
 
 		} while (not m_promise_state.compare_exchange_weak(previous, newval, std::memory_order_relaxed));
+
+		trace_satisfied(this, reason);
 		return true;
 	}
 
@@ -407,6 +469,7 @@ namespace ext
 
 		} while (not m_promise_state.compare_exchange_weak(previous, newval, std::memory_order_relaxed));
 
+		trace_satisfied(this, future_state::cancellation);
 		set_future_ready();
 		return true;
 	}
@@ -547,6 +610,38 @@ namespace ext
 	}
 
 
+	unsigned when_bulk_continuation::release() noexcept
+	{
+		auto ref = m_refs.fetch_sub(1, std::memory_order_release);
+		if (ref == 1)
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			// memory is owned by parent, this can destroy us
+			m_parent->release();
+		}
+
+		return --ref;
+	}
+
+	bool when_bulk_continuation::attach(parent_task_type * parent, std::size_t index, shared_state_basic * handle) noexcept
+	{
+		if (handle->is_deferred())
+		{
+			parent->notify_satisfied(index);
+			return false;
+		}
+
+		// we hold parent reference until released by continuation chain, see release
+		m_parent = parent;
+		m_index = index;
+		m_parent->addref();
+
+		bool attached = handle->add_continuation(this);
+		release();
+		return attached;
+	}
+
+
 	void continuation_waiter_impl::continuate(shared_state_basic * caller) noexcept
 	{
 		{
@@ -584,20 +679,155 @@ namespace ext
 
 
 
+#if BOOST_OS_LINUX
+	/// implementation of continuation_waiter using atomic state and linux futex.
+	/// Waiting thread spins for a short time, most futures waited on are almost ready,
+	/// and only then sleeps on futex. continuate makes syscall only if there are sleeping threads.
+	class continuation_waiter_futex : public continuation_waiter
+	{
+	private:
+		static constexpr unsigned max_spin_count = 128;
+
+		// state values: not ready, not ready and there are threads sleeping on futex, ready
+		static constexpr int waiting  = 0;
+		static constexpr int sleeping = 1;
+		static constexpr int signaled = 2;
+
+		std::atomic_int m_state = ATOMIC_VAR_INIT(waiting);
+
+	private:
+		bool spin() noexcept;
+		/// sleeps on futex until state is changed from sleeping, or timeout expires(timeout == nullptr - infinite)
+		void sleep(const timespec * timeout) noexcept;
+		bool wait_until(std::chrono::steady_clock::time_point timeout_point) noexcept;
+
+	public:
+		void wait_ready() noexcept override;
+		bool wait_ready(std::chrono::steady_clock::time_point timeout_point) noexcept override;
+		bool wait_ready(std::chrono::steady_clock::duration   timeout_duration) noexcept override;
+
+	public:
+		void continuate(shared_state_basic * caller) noexcept override;
+		void reset() noexcept override;
+	};
+
+	static_assert(sizeof(std::atomic_int) == sizeof(int), "futex requires plain int layout of std::atomic_int");
+
+	bool continuation_waiter_futex::spin() noexcept
+	{
+		// on single cpu spinning only delays thread, that will make us ready
+		static const unsigned spin_count = std::thread::hardware_concurrency() > 1 ? max_spin_count : 0;
+
+		for (unsigned n = spin_count; n; --n)
+		{
+			if (m_state.load(std::memory_order_acquire) == signaled)
+				return true;
+
+			cpu_relax();
+		}
+
+		return false;
+	}
+
+	void continuation_waiter_futex::sleep(const timespec * timeout) noexcept
+	{
+		// announce sleeping, continuate will wake us. If state is already signaled - cas fails, no sleeping
+		int state = waiting;
+		if (not m_state.compare_exchange_strong(state, sleeping, std::memory_order_acquire) and state == signaled)
+			return;
+
+		// EINTR, EAGAIN and ETIMEDOUT are handled by callers by rechecking state
+		::syscall(SYS_futex, reinterpret_cast<int *>(&m_state), FUTEX_WAIT_PRIVATE, sleeping, timeout, nullptr, 0);
+	}
+
+	void continuation_waiter_futex::wait_ready() noexcept
+	{
+		if (spin()) return;
+
+		while (m_state.load(std::memory_order_acquire) != signaled)
+			sleep(nullptr);
+	}
+
+	bool continuation_waiter_futex::wait_until(std::chrono::steady_clock::time_point timeout_point) noexcept
+	{
+		// FUTEX_WAIT takes relative timeout, measured by CLOCK_MONOTONIC, same as steady_clock
+		for (;;)
+		{
+			if (m_state.load(std::memory_order_acquire) == signaled)
+				return true;
+
+			auto now = std::chrono::steady_clock::now();
+			if (now >= timeout_point)
+				return false;
+
+			auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout_point - now).count();
+			timespec timeout;
+			timeout.tv_sec  = static_cast<time_t>(left / 1000000000);
+			timeout.tv_nsec = static_cast<long>(left % 1000000000);
+
+			sleep(&timeout);
+		}
+	}
+
+	bool continuation_waiter_futex::wait_ready(std::chrono::steady_clock::time_point timeout_point) noexcept
+	{
+		return spin() or wait_until(timeout_point);
+	}
+
+	bool continuation_waiter_futex::wait_ready(std::chrono::steady_clock::duration timeout_duration) noexcept
+	{
+		auto timeout_point = std::chrono::steady_clock::now() + timeout_duration;
+		return spin() or wait_until(timeout_point);
+	}
+
+	void continuation_waiter_futex::continuate(shared_state_basic * caller) noexcept
+	{
+		// run_continuations holds reference to us, so waking is safe even if waiting thread already returned
+		if (m_state.exchange(signaled, std::memory_order_release) == sleeping)
+			::syscall(SYS_futex, reinterpret_cast<int *>(&m_state), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+	}
+
+	void continuation_waiter_futex::reset() noexcept
+	{
+		m_state.store(waiting, std::memory_order_relaxed);
+		m_fstnext.store(fsnext_init, std::memory_order_relaxed);
+		m_promise_state.store(static_cast<unsigned>(future_state::unsatisfied), std::memory_order_relaxed);
+	}
+#endif
+
+	static auto make_waiter(waiter_kind kind) -> continuation_waiters_pool::waiter_ptr
+	{
+	#if BOOST_OS_LINUX
+		if (kind == waiter_kind::futex)
+			return ext::make_intrusive<continuation_waiter_futex>();
+	#endif
+
+		return ext::make_intrusive<continuation_waiter_impl>();
+	}
+
+	// futex waiters are opt-in until their spin phase is measured on multi cpu machines,
+	// see future_waiter_kind_benchmark test
+	static constexpr waiter_kind default_waiter_kind = waiter_kind::condvar;
+
+
 	class default_continuation_waiters_pool : public continuation_waiters_pool
 	{
 	protected:
 		std::atomic_uint m_usecount = ATOMIC_VAR_INIT(0);
+		waiter_kind m_kind = default_waiter_kind;
 
 	public:
 		void take(waiter_ptr & ptr) override;
 		void putback(waiter_ptr & ptr) override;
 		bool used() const noexcept override { return m_usecount.load(std::memory_order_relaxed); }
+
+	public:
+		void kind(waiter_kind kind) noexcept { m_kind = kind; }
 	};
 
 	void default_continuation_waiters_pool::take(waiter_ptr & ptr)
 	{
-		ptr = ext::make_intrusive<ext::continuation_waiter_impl>();
+		ptr = make_waiter(m_kind);
 		m_usecount.fetch_add(1, std::memory_order_relaxed);
 	}
 
@@ -615,6 +845,7 @@ namespace ext
 		std::atomic<std::size_t> m_last_avail;
 		std::atomic<std::size_t> m_first_free;
 		std::atomic<std::size_t> m_usecount = 0;
+		waiter_kind m_kind = default_waiter_kind;
 		
 		std::vector<waiter_ptr> m_objects;
 	
@@ -628,7 +859,7 @@ namespace ext
 		bool used() const noexcept override;
 	
 	public:
-		arena_continuation_pool(std::size_t num) { init(num); }
+		arena_continuation_pool(std::size_t num, waiter_kind kind = default_waiter_kind) : m_kind(kind) { init(num); }
 		~arena_continuation_pool() { free(); }
 
 	protected:
@@ -639,7 +870,7 @@ namespace ext
 	{
 		m_objects.resize(num);
 		for (auto & val : m_objects)
-			val = ext::make_intrusive<ext::continuation_waiter_impl>();
+			val = make_waiter(m_kind);
 	
 		// Strictly speaking lockfree_continuation_pool should be created and initiated before any thread are created,
 		// any new threads will happen later and see anything done here, without any memory_fence. so this one is unneeded.
@@ -669,7 +900,7 @@ namespace ext
 			if (new_first == last)
 			{
 				//throw std::runtime_error("ext::future: waiter pool exhausted, see init_future_library");
-				ptr = ext::make_intrusive<ext::continuation_waiter_impl>();
+				ptr = make_waiter(m_kind);
 				m_usecount.fetch_add(1, std::memory_order_relaxed);
 				return;
 			}
@@ -752,6 +983,11 @@ namespace ext
 	}
 
 	bool init_future_library(unsigned waiter_slots)
+	{
+		return init_future_library(waiter_slots, default_waiter_kind);
+	}
+
+	bool init_future_library(unsigned waiter_slots, waiter_kind kind)
 	{
 		if (g_pool->used()) return false;
 
@@ -761,11 +997,12 @@ namespace ext
 		// waiter_slots == 0 - use default_continuation_waiters_pool: allocate waiters new/delete
 		if (waiter_slots == 0)
 		{
+			g_default_pool.kind(kind);
 			g_pool = &g_default_pool;
 			return true;
 		}
 		
-		g_pool = new arena_continuation_pool(waiter_slots);
+		g_pool = new arena_continuation_pool(waiter_slots, kind);
 		return true;
 	}
 
@@ -0,0 +1,231 @@
+#ifdef EXT_FUTURE_TRACING
+
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <boost/core/demangle.hpp>
+#include <ext/future_tracing.hpp>
+
+namespace ext
+{
+	// open spans of current thread: executions and continuations are strictly nested on thread
+	static thread_local std::vector<chrome_trace_recorder::event> g_open_spans;
+
+	unsigned chrome_trace_recorder::current_tid() noexcept
+	{
+		static std::atomic_uint counter = ATOMIC_VAR_INIT(0);
+		thread_local unsigned tid = counter.fetch_add(1, std::memory_order_relaxed) + 1;
+		return tid;
+	}
+
+	void chrome_trace_recorder::record(event && ev) noexcept
+	{
+		try
+		{
+			std::lock_guard lk(m_mutex);
+			m_events.push_back(std::move(ev));
+		}
+		catch (std::bad_alloc &)
+		{
+			// event is lost, tracing should not break traced program
+		}
+	}
+
+	void chrome_trace_recorder::start_span(event_kind kind, const shared_state_basic * state, const shared_state_basic * caller) noexcept
+	{
+		event ev;
+		ev.kind = kind;
+		ev.tid = current_tid();
+		ev.state = state->trace_id();
+		ev.caller = caller ? caller->trace_id() : 0;
+		ev.type = &typeid(*state);
+		ev.start = clock_type::now();
+
+		try
+		{
+			g_open_spans.push_back(ev);
+		}
+		catch (std::bad_alloc &)
+		{
+			// span is lost, finish_span ignores empty stack
+		}
+	}
+
+	void chrome_trace_recorder::finish_span() noexcept
+	{
+		if (g_open_spans.empty()) return;
+
+		auto ev = g_open_spans.back();
+		g_open_spans.pop_back();
+
+		ev.finish = clock_type::now();
+		record(std::move(ev));
+	}
+
+	void chrome_trace_recorder::created(const shared_state_basic * state) noexcept
+	{
+		event ev;
+		ev.kind = event_kind::created;
+		ev.tid = current_tid();
+		ev.state = state->trace_id();
+		ev.start = clock_type::now();
+		record(std::move(ev));
+	}
+
+	void chrome_trace_recorder::satisfied(const shared_state_basic * state, future_state reason) noexcept
+	{
+		event ev;
+		ev.kind = event_kind::satisfied;
+		ev.reason = reason;
+		ev.tid = current_tid();
+		ev.state = state->trace_id();
+		ev.start = clock_type::now();
+		record(std::move(ev));
+	}
+
+	void chrome_trace_recorder::execution_started(const shared_state_basic * state) noexcept
+	{
+		start_span(event_kind::execution, state, nullptr);
+	}
+
+	void chrome_trace_recorder::execution_finished(const shared_state_basic * state) noexcept
+	{
+		finish_span();
+	}
+
+	void chrome_trace_recorder::continuation_started(const shared_state_basic * caller, const shared_state_basic * continuation) noexcept
+	{
+		start_span(event_kind::continuation, continuation, caller);
+	}
+
+	void chrome_trace_recorder::continuation_finished(const shared_state_basic * caller, const shared_state_basic * continuation) noexcept
+	{
+		finish_span();
+	}
+
+	auto chrome_trace_recorder::events() const -> std::vector<event>
+	{
+		std::lock_guard lk(m_mutex);
+		return m_events;
+	}
+
+	void chrome_trace_recorder::clear()
+	{
+		std::lock_guard lk(m_mutex);
+		m_events.clear();
+	}
+
+	static const char * reason_name(future_state reason) noexcept
+	{
+		switch (reason)
+		{
+			case future_state::value:        return "value";
+			case future_state::exception:    return "exception";
+			case future_state::cancellation: return "cancellation";
+			case future_state::abandonned:   return "abandonned";
+			default:                         return "unknown";
+		}
+	}
+
+	static void write_escaped(std::ostream & os, const std::string & str)
+	{
+		for (char ch : str)
+		{
+			if (ch == '"' or ch == '\\') os << '\\';
+			os << ch;
+		}
+	}
+
+	void chrome_trace_recorder::write_json(std::ostream & os) const
+	{
+		auto events = this->events();
+		auto ts = [this](time_point tp) { return std::chrono::duration<double, std::micro>(tp - m_start).count(); };
+
+		// creation and satisfaction events by state, for building flows
+		std::unordered_map<std::uint64_t, const event *> created, satisfied;
+		for (auto & ev : events)
+		{
+			if (ev.kind == event_kind::created)   created.emplace(ev.state, &ev);
+			if (ev.kind == event_kind::satisfied) satisfied.emplace(ev.state, &ev);
+		}
+
+		auto flags = os.flags();
+		auto precision = os.precision();
+		os.setf(std::ios::fixed, std::ios::floatfield);
+		os.precision(3);
+
+		const char * sep = "\n";
+		auto write_head = [&os, &sep](const char * ph, unsigned tid, double ts)
+		{
+			os << sep << R"({"cat":"future","pid":1,"ph":")" << ph << R"(","tid":)" << tid << R"(,"ts":)" << ts;
+			sep = ",\n";
+		};
+
+		std::uint64_t flow_id = 0;
+		auto write_flow = [&](const event * from, const event & to)
+		{
+			++flow_id;
+			write_head("s", from->tid, ts(from->start));
+			os << R"(,"name":"flow","id":)" << flow_id << "}";
+			write_head("f", to.tid, ts(to.start));
+			os << R"(,"name":"flow","bp":"e","id":)" << flow_id << "}";
+		};
+
+		os << R"({"displayTimeUnit":"ns","traceEvents":[)";
+		for (auto & ev : events)
+		{
+			switch (ev.kind)
+			{
+				case event_kind::created:
+					write_head("i", ev.tid, ts(ev.start));
+					os << R"(,"s":"t","name":"created","args":{"state":)" << ev.state << "}}";
+					break;
+
+				case event_kind::satisfied:
+					write_head("i", ev.tid, ts(ev.start));
+					os << R"(,"s":"t","name":"satisfied: )" << reason_name(ev.reason) << R"(","args":{"state":)" << ev.state << "}}";
+					break;
+
+				case event_kind::execution:
+				case event_kind::continuation:
+				{
+					auto type = boost::core::demangle(ev.type->name());
+					write_head("X", ev.tid, ts(ev.start));
+					os << R"(,"dur":)" << ts(ev.finish) - ts(ev.start) << R"(,"name":")";
+					write_escaped(os, type.substr(0, type.find('<')));
+					os << R"(","args":{"state":)" << ev.state;
+					if (ev.kind == event_kind::continuation) os << R"(,"caller":)" << ev.caller;
+					os << R"(,"type":")";
+					write_escaped(os, type);
+					os << "\"}}";
+
+					// execution is linked with creation of task, continuation - with satisfaction of it's caller
+					auto & from = ev.kind == event_kind::execution ? created : satisfied;
+					auto it = from.find(ev.kind == event_kind::execution ? ev.state : ev.caller);
+					if (it != from.end()) write_flow(it->second, ev);
+					break;
+				}
+			}
+		}
+
+		os << "\n]}\n";
+		os.flags(flags);
+		os.precision(precision);
+	}
+
+	void chrome_trace_recorder::write_json(const std::string & path) const
+	{
+		std::ofstream ofs(path, std::ios::out | std::ios::trunc);
+		if (not ofs)
+			throw std::runtime_error("ext::chrome_trace_recorder: can't open " + path);
+
+		write_json(ofs);
+		ofs.close();
+
+		if (not ofs)
+			throw std::runtime_error("ext::chrome_trace_recorder: failed to write " + path);
+	}
+}
+
+#endif // EXT_FUTURE_TRACING
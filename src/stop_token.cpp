@@ -0,0 +1,84 @@
+#include <ext/stop_token.hpp>
+
+namespace ext
+{
+	void stop_state::unlink(stop_callback_base * callback) noexcept
+	{
+		if (callback->m_prev) callback->m_prev->m_next = callback->m_next;
+		else                  m_head = callback->m_next;
+
+		if (callback->m_next) callback->m_next->m_prev = callback->m_prev;
+
+		callback->m_prev = callback->m_next = nullptr;
+		callback->m_linked = false;
+	}
+
+	bool stop_state::add(stop_callback_base * callback) noexcept
+	{
+		std::lock_guard lk(m_mutex);
+		// checked under lock: request_stop sets flag before draining list under same lock
+		if (m_stop_requested.load(std::memory_order_relaxed))
+			return false;
+
+		callback->m_next = m_head;
+		if (m_head) m_head->m_prev = callback;
+		m_head = callback;
+		callback->m_linked = true;
+
+		return true;
+	}
+
+	void stop_state::remove(stop_callback_base * callback) noexcept
+	{
+		std::unique_lock lk(m_mutex);
+		if (callback->m_linked)
+			return unlink(callback);
+
+		// callback was already invoked or is being invoked right now.
+		// If it's invoked by other thread - wait for completion,
+		// if by this one - callback destroys itself from invoke, nothing to wait
+		if (m_invoking == callback and m_stopping_thread != std::this_thread::get_id())
+			m_invoked.wait(lk, [this, callback] { return m_invoking != callback; });
+	}
+
+	bool stop_state::request_stop() noexcept
+	{
+		if (m_stop_requested.exchange(true, std::memory_order_acq_rel))
+			return false;
+
+		std::unique_lock lk(m_mutex);
+		m_stopping_thread = std::this_thread::get_id();
+
+		while (m_head)
+		{
+			// callback is invoked without lock: it can register/unregister other callbacks.
+			// After invoke callback object should not be touched - it can be already destroyed
+			auto * callback = m_head;
+			unlink(callback);
+			m_invoking = callback;
+
+			lk.unlock();
+			callback->invoke();
+			lk.lock();
+
+			m_invoking = nullptr;
+			m_invoked.notify_all();
+		}
+
+		return true;
+	}
+
+	void stop_callback_base::attach(const stop_token & token) noexcept
+	{
+		if (not token.m_state) return;
+
+		m_state = token.m_state;
+		if (not m_state->add(this))
+			invoke();
+	}
+
+	void stop_callback_base::detach() noexcept
+	{
+		if (m_state) m_state->remove(this);
+	}
+}
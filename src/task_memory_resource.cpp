@@ -0,0 +1,80 @@
+#include <cassert>
+#include <ext/task_memory_resource.hpp>
+
+namespace ext
+{
+	unsigned task_memory_resource::current_shard() noexcept
+	{
+		// threads are assigned to shards in round robin order on first use
+		static std::atomic_uint counter = ATOMIC_VAR_INIT(0);
+		thread_local unsigned index = counter.fetch_add(1, std::memory_order_relaxed) % shard_count;
+		return index;
+	}
+
+	auto task_memory_resource::allocate_slab(std::size_t block_size) -> free_block *
+	{
+		auto size = block_size * m_blocks_per_slab;
+		auto * ptr = static_cast<char *>(m_upstream->allocate(size, granularity));
+
+		try
+		{
+			std::lock_guard lk(m_slabs_mutex);
+			m_slabs.push_back({ptr, size});
+		}
+		catch (...)
+		{
+			m_upstream->deallocate(ptr, size, granularity);
+			throw;
+		}
+
+		// chain blocks of slab into free list
+		free_block * head = nullptr;
+		for (auto n = m_blocks_per_slab; n; --n)
+			head = new (ptr + (n - 1) * block_size) free_block {head};
+
+		return head;
+	}
+
+	void * task_memory_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+	{
+		if (bytes > max_block_size or alignment > granularity)
+			return m_upstream->allocate(bytes, alignment);
+
+		auto idx = bytes ? (bytes - 1) / granularity : 0;
+		auto & sh = m_classes[idx].shards[current_shard()];
+
+		std::lock_guard lk(sh.mutex);
+		if (not sh.head)
+			sh.head = allocate_slab((idx + 1) * granularity);
+
+		auto * block = sh.head;
+		sh.head = block->next;
+		return block;
+	}
+
+	void task_memory_resource::do_deallocate(void * ptr, std::size_t bytes, std::size_t alignment)
+	{
+		if (bytes > max_block_size or alignment > granularity)
+			return m_upstream->deallocate(ptr, bytes, alignment);
+
+		// block can be returned into any shard of it's size class, use shard of current thread
+		auto idx = bytes ? (bytes - 1) / granularity : 0;
+		auto & sh = m_classes[idx].shards[current_shard()];
+
+		std::lock_guard lk(sh.mutex);
+		sh.head = new (ptr) free_block {sh.head};
+	}
+
+	task_memory_resource::task_memory_resource(std::size_t blocks_per_slab, std::pmr::memory_resource * upstream)
+		: m_upstream(upstream), m_blocks_per_slab(blocks_per_slab), m_classes(std::make_unique<size_class[]>(class_count))
+	{
+		assert(upstream);
+		assert(blocks_per_slab > 0);
+	}
+
+	task_memory_resource::~task_memory_resource() noexcept
+	{
+		for (auto & sl : m_slabs)
+			m_upstream->deallocate(sl.ptr, sl.size, granularity);
+	}
+}
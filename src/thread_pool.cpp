@@ -1,9 +1,152 @@
-﻿#include <algorithm>
+﻿#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
 #include <ext/thread_pool.hpp>
+#include <boost/predef.h>
 #include <boost/iterator/transform_iterator.hpp>
+#include "cpu_relax.hpp"
+
+#if BOOST_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#elif BOOST_OS_WINDOWS
+// windows.h min/max macros break std::min/std::max used below
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
 
 namespace ext
 {
+	/// adds value to atomic counter, which is modified only by current thread
+	template <class Type>
+	static inline void add_owned(std::atomic<Type> & counter, Type value) noexcept
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	/// index of queue wait histogram bucket for given wait time, see thread_pool_stats::queue_wait
+	static unsigned latency_bucket(std::chrono::steady_clock::duration wait) noexcept
+	{
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+		unsigned idx = 0;
+		for (; us > 0 and idx < thread_pool_stats::latency_buckets - 1; us >>= 1)
+			++idx;
+
+		return idx;
+	}
+
+	/// sets affinity of thread to given cpus, empty set - to all cpus of process
+	static std::error_code set_native_thread_affinity(std::thread & thr, const std::vector<unsigned> & cpus) noexcept
+	{
+	#if BOOST_OS_LINUX
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		if (cpus.empty())
+		{
+			if (::sched_getaffinity(0, sizeof(set), &set) != 0)
+				return std::error_code(errno, std::generic_category());
+		}
+		else
+		{
+			for (auto cpu : cpus)
+			{
+				if (cpu >= CPU_SETSIZE) return std::make_error_code(std::errc::invalid_argument);
+				CPU_SET(cpu, &set);
+			}
+		}
+
+		int res = ::pthread_setaffinity_np(thr.native_handle(), sizeof(set), &set);
+		return std::error_code(res, std::generic_category());
+
+	#elif BOOST_OS_WINDOWS
+		DWORD_PTR mask = 0, sysmask;
+		if (cpus.empty())
+		{
+			if (not ::GetProcessAffinityMask(::GetCurrentProcess(), &mask, &sysmask))
+				return std::error_code(::GetLastError(), std::system_category());
+		}
+		else
+		{
+			for (auto cpu : cpus)
+			{
+				if (cpu >= sizeof(mask) * CHAR_BIT) return std::make_error_code(std::errc::invalid_argument);
+				mask |= DWORD_PTR(1) << cpu;
+			}
+		}
+
+		if (not ::SetThreadAffinityMask(thr.native_handle(), mask))
+			return std::error_code(::GetLastError(), std::system_category());
+
+		return {};
+
+	#else
+		return std::make_error_code(std::errc::not_supported);
+	#endif
+	}
+
+	/// checks that cpus can be used for affinity: all of them are allowed for process(affinity of calling thread)
+	static std::error_code check_native_thread_affinity(const std::vector<unsigned> & cpus) noexcept
+	{
+	#if BOOST_OS_LINUX
+		cpu_set_t set;
+		if (::sched_getaffinity(0, sizeof(set), &set) != 0)
+			return std::error_code(errno, std::generic_category());
+
+		for (auto cpu : cpus)
+			if (cpu >= CPU_SETSIZE or not CPU_ISSET(cpu, &set))
+				return std::make_error_code(std::errc::invalid_argument);
+
+		return {};
+
+	#elif BOOST_OS_WINDOWS
+		DWORD_PTR mask, sysmask;
+		if (not ::GetProcessAffinityMask(::GetCurrentProcess(), &mask, &sysmask))
+			return std::error_code(::GetLastError(), std::system_category());
+
+		for (auto cpu : cpus)
+			if (cpu >= sizeof(mask) * CHAR_BIT or not (mask & (DWORD_PTR(1) << cpu)))
+				return std::make_error_code(std::errc::invalid_argument);
+
+		return {};
+
+	#else
+		return std::make_error_code(std::errc::not_supported);
+	#endif
+	}
+
+	/// sets thread name to prefix + index, if supported by platform
+	static std::error_code set_native_thread_name(std::thread & thr, const std::string & prefix, std::size_t index) noexcept
+	{
+	#if BOOST_OS_LINUX
+		// linux limits thread name to 16 bytes, including terminating zero.
+		// Prefix is truncated, index is always kept - otherwise workers are indistinguishable
+		char buffer[16];
+		char index_buffer[std::numeric_limits<std::size_t>::digits10 + 2];
+		auto index_len = static_cast<std::size_t>(std::snprintf(index_buffer, sizeof(index_buffer), "%zu", index));
+		index_len = std::min(index_len, sizeof(buffer) - 1);
+
+		auto len = prefix.copy(buffer, sizeof(buffer) - 1 - index_len);
+		std::memcpy(buffer + len, index_buffer, index_len);
+		buffer[len + index_len] = 0;
+
+		int res = ::pthread_setname_np(thr.native_handle(), buffer);
+		return std::error_code(res, std::generic_category());
+	#else
+		return {};
+	#endif
+	}
+
+	thread_local thread_pool::worker * thread_pool::ms_current_worker = nullptr;
+
 	thread_pool::worker::worker(thread_pool * parent)
 	{
 		m_parent = parent;
@@ -12,11 +155,95 @@ namespace ext
 	
 	void thread_pool::worker::thread_func(worker_ptr self)
 	{
-		self->m_parent->thread_func(self->m_stop_request);
+		auto * parent = self->m_parent;
+		if (parent->m_flags & thread_pool_flags::work_stealing)
+			parent->stealing_thread_func(*self);
+		else
+			parent->thread_func(*self);
+
+		parent->retire_worker(*self);
+
 		// mark ready on exit
 		self->set_value();
 	}
 
+	thread_pool::task_ring::task_ring(std::size_t capacity)
+		: m_cells(std::make_unique<cell[]>(capacity)), m_mask(capacity - 1)
+	{
+		assert(capacity >= 2 and (capacity & m_mask) == 0);
+		for (std::size_t i = 0; i < capacity; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	bool thread_pool::task_ring::push(task_base * task) noexcept
+	{
+		// every cell has sequence number:
+		//  * sequence == pos     - cell is free for enqueue at pos;
+		//  * sequence == pos + 1 - cell is filled for dequeue at pos;
+		// position is claimed by CAS, after that cell is filled and published by sequence store.
+		cell * c;
+		auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			c = &m_cells[pos & m_mask];
+			auto seq = c->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+			if (diff == 0)
+			{
+				if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false; // full
+			else
+				pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		}
+
+		c->task = task;
+		c->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	auto thread_pool::task_ring::pop() noexcept -> task_base *
+	{
+		cell * c;
+		auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			c = &m_cells[pos & m_mask];
+			auto seq = c->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+
+			if (diff == 0)
+			{
+				if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return nullptr; // empty
+			else
+				pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		}
+
+		auto * task = c->task;
+		// free cell for enqueue on next lap
+		c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+		return task;
+	}
+
+	bool thread_pool::task_ring::empty() const noexcept
+	{
+		return m_dequeue_pos.load(std::memory_order_relaxed) >= m_enqueue_pos.load(std::memory_order_relaxed);
+	}
+
+	std::size_t thread_pool::task_ring::size() const noexcept
+	{
+		auto deq = m_dequeue_pos.load(std::memory_order_relaxed);
+		auto enq = m_enqueue_pos.load(std::memory_order_relaxed);
+		return enq > deq ? enq - deq : 0;
+	}
+
 	bool thread_pool::worker::stop_request() noexcept
 	{
 		return m_stop_request.exchange(true, std::memory_order_relaxed);
@@ -36,9 +263,12 @@ namespace ext
 			auto & delayed_count = m_owner->m_delayed_count;
 			auto it = list.iterator_to(*this);
 			list.erase(it);
+			--m_owner->m_ndelayed;
 			
-			m_owner->m_tasks.push_back(*m_task.release());
-			bool notify = delayed_count == 0 || --delayed_count == 0;
+			m_task->m_enqueued = std::chrono::steady_clock::now();
+			m_owner->enqueue_task(*m_task.release());
+			// if delayed_count is not 0 - clear is waiting for us, otherwise notify only if there are parked workers
+			bool notify = delayed_count == 0 ? m_owner->m_nsleeping.load(std::memory_order_relaxed) != 0 : --delayed_count == 0;
 			
 			// Notify thread_pool if needed
 			// NOTE: Notify have to be done under lock,
@@ -81,32 +311,39 @@ namespace ext
 	{
 		std::unique_lock lk(m_mutex);
 		if (n == m_pending) return ext::make_ready_future();
-		unsigned old_size = static_cast<unsigned>(m_workers.size());
 
-		auto first = m_workers.begin();
-		auto last = m_workers.end();
-
-		if (n > old_size - m_pending)
+		if (n > m_pending)
 		{
-			first = std::remove_if(last - m_pending, last, join_worker);
-			m_pending = last - first;
-			m_workers.resize(n + m_pending);
-
-			first = m_workers.begin() + old_size;
-			last = m_workers.end() - m_pending;
+			// join and remove already finished stopping workers
+			auto first = std::remove_if(m_workers.begin() + m_pending, m_workers.end(), join_worker);
+			m_workers.erase(first, m_workers.end());
 
-			std::move(first, first + m_pending, last);
+			// new workers are placed right after working ones, stopping workers are shifted after them
+			m_workers.insert(m_workers.begin() + m_pending, n - m_pending, nullptr);
+			auto it = m_workers.begin() + m_pending;
 
-			for (; first != last; ++first)
-				*first = ext::make_intrusive<worker>(this);
+			try
+			{
+				for (; m_pending < n; ++m_pending, ++it)
+				{
+					*it = ext::make_intrusive<worker>(this);
+					// best effort, see set_affinity
+					apply_thread_options(**it, m_pending);
+				}
+			}
+			catch (...)
+			{
+				m_workers.erase(it, m_workers.begin() + n);
+				throw;
+			}
 
 			return ext::make_ready_future();
 		}
 		else
 		{
-			first += n;
-			last -= m_pending;
-			m_pending += old_size - n;
+			auto first = m_workers.begin() + n;
+			auto last  = m_workers.begin() + m_pending;
+			m_pending = n;
 
 			auto func = [](const worker_ptr & wptr) { return ext::future<void>(wptr); };
 
@@ -124,32 +361,630 @@ namespace ext
 		}
 	}
 
-	void thread_pool::thread_func(std::atomic_bool & stop_request)
+	void thread_pool::thread_func(worker & self)
 	{
+		auto & stop_request = self.m_stop_request;
+		auto last = std::chrono::steady_clock::now();
 		std::unique_lock lk(m_mutex, std::defer_lock);
 
 		for (;;)
 		{
-			ext::intrusive_ptr<task_base> task_ptr;
+			task_base * task;
+
+			// lockfree_queue mode: take from ring without locking, unless there are high priority tasks
+			if (stop_request.load(std::memory_order_relaxed)) return;
+			if ((task = ring_pop())) goto execute;
+
 			lk.lock();
 
 			if (stop_request.load(std::memory_order_relaxed)) return;
-			if (not m_tasks.empty()) goto avail;
+			if ((task = pop_task())) goto avail;
+
+			idle_spin(lk, stop_request);
+			if (stop_request.load(std::memory_order_relaxed)) return;
+			if ((task = pop_task())) goto avail;
 
 		again:
+			m_nsleeping.fetch_add(1, std::memory_order_relaxed);
+			// ring is pushed without lock, see push_task
+			if (m_ring)
+			{
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if ((task = m_ring->pop()))
+				{
+					m_nsleeping.fetch_sub(1, std::memory_order_relaxed);
+					goto avail;
+				}
+			}
+
 			m_event.wait(lk);
+			m_nsleeping.fetch_sub(1, std::memory_order_relaxed);
 
 			if (stop_request.load(std::memory_order_relaxed)) return;
-			if (m_tasks.empty()) goto again;
+			if (not (task = pop_task())) goto again;
 			
 		avail:
-			task_ptr.reset(&m_tasks.front(), ext::noaddref);
-			m_tasks.pop_front();
-
 			lk.unlock();
 
+		execute:
+			execute_task(self, task, last);
+		}
+	}
+
+	void thread_pool::stealing_thread_func(worker & self)
+	{
+		auto & stop_request = self.m_stop_request;
+		auto last = std::chrono::steady_clock::now();
+		std::unique_lock lk(m_mutex, std::defer_lock);
+		ms_current_worker = &self;
+
+		for (;;)
+		{
+			ext::intrusive_ptr<task_base> task_ptr;
+			if (stop_request.load(std::memory_order_relaxed)) break;
+
+			// own deque first, recently submitted tasks are most likely still hot in cache.
+			// But high priority tasks go before them.
+			if (m_nhigh.load(std::memory_order_relaxed) == 0)
+			{
+				std::lock_guard local_lk(self.m_local_mutex);
+				if (not self.m_local_tasks.empty())
+				{
+					task_ptr.reset(&self.m_local_tasks.back(), ext::noaddref);
+					self.m_local_tasks.pop_back();
+					self.m_nlocal.fetch_sub(1, std::memory_order_relaxed);
+				}
+			}
+
+			if (not task_ptr)
+				task_ptr.reset(ring_pop(), ext::noaddref);
+
+			if (not task_ptr)
+			{
+				lk.lock();
+
+				for (bool spinned = false;; spinned = true)
+				{
+					if (stop_request.load(std::memory_order_relaxed)) goto exit;
+					if (auto * task = pop_task())
+					{
+						task_ptr.reset(task, ext::noaddref);
+						break;
+					}
+
+					// spin only once, before first parking
+					if (not spinned)
+					{
+						idle_spin(lk, stop_request);
+						continue;
+					}
+
+					// we must be counted as sleeping before looking into deques of other workers:
+					// pusher into local deque locks same deque mutex, so it either sees us sleeping and wakes us,
+					// or we see it's task. Ring pusher does not lock anything, fence orders us with it, see push_task.
+					m_nsleeping.fetch_add(1, std::memory_order_relaxed);
+					if (m_ring) std::atomic_thread_fence(std::memory_order_seq_cst);
+
+					auto * task = m_ring ? m_ring->pop() : nullptr;
+					if (task or (task = steal_task(self)))
+					{
+						m_nsleeping.fetch_sub(1, std::memory_order_relaxed);
+						task_ptr.reset(task, ext::noaddref);
+						break;
+					}
+
+					m_event.wait(lk);
+					m_nsleeping.fetch_sub(1, std::memory_order_relaxed);
+				}
+
+				lk.unlock();
+			}
+
+			execute_task(self, task_ptr.release(), last);
+		}
+
+		lk.lock();
+
+	exit:
+		// tasks left in our deque are moved into shared list, where other workers can take them
+		ms_current_worker = nullptr;
+		flush_local_tasks(self);
+		m_event.notify_one();
+	}
+
+	void thread_pool::execute_task(worker & self, task_base * task, std::chrono::steady_clock::time_point & last) noexcept
+	{
+		auto & counters = self.m_counters;
+		auto start = std::chrono::steady_clock::now();
+		add_owned(counters.idle, (start - last).count());
+		add_owned(counters.queue_wait[latency_bucket(start - task->m_enqueued)], std::uint64_t(1));
+		// published for stats/autoscaling, so long running tasks are seen as busy time before they finish
+		counters.task_start.store(start.time_since_epoch().count(), std::memory_order_relaxed);
+
+		{
+			ext::intrusive_ptr<task_base> task_ptr(task, ext::noaddref);
 			task_ptr->task_execute();
 		}
+
+		last = std::chrono::steady_clock::now();
+		add_owned(counters.busy, (last - start).count());
+		counters.task_start.store(0, std::memory_order_release);
+		add_owned(counters.executed, std::uint64_t(1));
+	}
+
+	void thread_pool::retire_worker(worker & self) noexcept
+	{
+		auto accumulate = [](auto & to, auto & from)
+		{
+			to.store(to.load(std::memory_order_relaxed) + from.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		};
+
+		std::lock_guard lk(m_mutex);
+		auto & from = self.m_counters;
+		auto & to = m_retired_counters;
+
+		accumulate(to.executed, from.executed);
+		accumulate(to.busy, from.busy);
+		accumulate(to.idle, from.idle);
+		for (unsigned idx = 0; idx < thread_pool_stats::latency_buckets; ++idx)
+			accumulate(to.queue_wait[idx], from.queue_wait[idx]);
+
+		self.m_retired = true;
+	}
+
+	void thread_pool::count_submitted(std::size_t count) noexcept
+	{
+		// threads are assigned to shards in round robin order on first use
+		static std::atomic_uint counter = ATOMIC_VAR_INIT(0);
+		thread_local unsigned index = counter.fetch_add(1, std::memory_order_relaxed) % counter_shards;
+		m_nsubmitted[index].value.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	thread_pool_stats thread_pool::stats() const
+	{
+		thread_pool_stats result;
+		auto load = [](auto & counter) { return counter.load(std::memory_order_relaxed); };
+
+		result.submitted = 0;
+		for (auto & shard : m_nsubmitted)
+			result.submitted += load(shard.value);
+
+		result.abandoned = load(m_nabandoned);
+		result.queue_depth = load(m_ntasks);
+		if (m_ring)
+			result.queue_depth += m_ring->size();
+
+		// m_mutex is held only to take consistent snapshot of retired totals and alive workers,
+		// counters of workers are read without any locks, so stats does not block submitters and workers
+		std::vector<worker_ptr> workers;
+		std::size_t npending;
+		{
+			std::lock_guard lk(m_mutex);
+			result.delayed = m_ndelayed;
+			result.executed = load(m_retired_counters.executed);
+			for (unsigned idx = 0; idx < thread_pool_stats::latency_buckets; ++idx)
+				result.queue_wait[idx] = load(m_retired_counters.queue_wait[idx]);
+
+			npending = m_pending;
+			workers.reserve(m_workers.size());
+			// retired workers are already accounted in totals, null keeps indexes of others
+			for (auto & wptr : m_workers)
+				workers.push_back(wptr->m_retired ? nullptr : wptr);
+		}
+
+		result.workers.reserve(npending);
+		auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+		for (std::size_t idx = 0; idx < workers.size(); ++idx)
+		{
+			if (not workers[idx]) continue;
+			auto & wrk = *workers[idx];
+
+			auto & counters = wrk.m_counters;
+			result.executed += load(counters.executed);
+			for (unsigned bucket = 0; bucket < thread_pool_stats::latency_buckets; ++bucket)
+				result.queue_wait[bucket] += load(counters.queue_wait[bucket]);
+
+			// work stealing mode: tasks in worker deques are waiting too
+			result.queue_depth += load(wrk.m_nlocal);
+
+			if (idx < npending)
+			{
+				auto & ws = result.workers.emplace_back();
+				ws.executed = load(counters.executed);
+				// task_start is read before busy: task finishing concurrently is counted twice rather than lost
+				auto start = counters.task_start.load(std::memory_order_acquire);
+				ws.running_time = thread_pool_stats::duration(start ? std::max(now - start, decltype(now)(0)) : 0);
+				ws.busy_time = thread_pool_stats::duration(load(counters.busy));
+				ws.idle_time = thread_pool_stats::duration(load(counters.idle));
+			}
+		}
+
+		return result;
+	}
+
+	std::error_code thread_pool::apply_thread_options(worker & wrk, std::size_t index) noexcept
+	{
+		std::error_code result;
+		try
+		{
+			if (not m_thread_name.empty())
+				result = set_native_thread_name(wrk.m_thread, m_thread_name, index);
+
+			if (m_affinity_configured)
+				if (auto ec = set_native_thread_affinity(wrk.m_thread, worker_affinity(index)))
+					result = ec;
+		}
+		catch (std::bad_alloc &)
+		{
+			result = std::make_error_code(std::errc::not_enough_memory);
+		}
+
+		return result;
+	}
+
+	std::vector<unsigned> thread_pool::worker_affinity(std::size_t index) const
+	{
+		if (m_affinity_mode == thread_pool_affinity::per_worker and not m_affinity_cpus.empty())
+			return {m_affinity_cpus[index % m_affinity_cpus.size()]};
+		else
+			return m_affinity_cpus;
+	}
+
+	void thread_pool::set_affinity(std::vector<unsigned> cpus, thread_pool_affinity mode)
+	{
+		// invalid cpus are rejected before anything is changed, so workers are not left half pinned
+		if (auto ec = check_native_thread_affinity(cpus))
+			throw std::system_error(ec, "ext::thread_pool::set_affinity: invalid cpu set");
+
+		std::lock_guard lk(m_mutex);
+		m_affinity_cpus = std::move(cpus);
+		m_affinity_mode = mode;
+		m_affinity_configured = true;
+
+		// setting is applied to every worker even if some fail, first error is reported
+		std::error_code result;
+		for (std::size_t idx = 0; idx < m_pending; ++idx)
+		{
+			auto ec = set_native_thread_affinity(m_workers[idx]->m_thread, worker_affinity(idx));
+			if (ec and not result) result = ec;
+		}
+
+		if (result)
+			throw std::system_error(result, "ext::thread_pool::set_affinity: failed to set worker affinity");
+	}
+
+	void thread_pool::set_thread_name(std::string prefix)
+	{
+		std::lock_guard lk(m_mutex);
+		m_thread_name = std::move(prefix);
+
+		for (std::size_t idx = 0; idx < m_pending; ++idx)
+			set_native_thread_name(m_workers[idx]->m_thread, m_thread_name, idx);
+	}
+
+	void thread_pool::autoscale_func(thread_pool_autoscale_options opts)
+	{
+		auto prev = stats();
+		auto threshold = latency_bucket(opts.grow_wait);
+		std::unique_lock lk(m_autoscale_mutex);
+
+		for (;;)
+		{
+			auto start = std::chrono::steady_clock::now();
+			m_autoscale_event.wait_for(lk, opts.interval, [this] { return m_autoscale_stop; });
+			if (m_autoscale_stop) return;
+
+			auto cur = stats();
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			auto nworkers = static_cast<unsigned>(cur.workers.size());
+
+			// number of workers was changed by somebody else - just take new baseline
+			if (nworkers != prev.workers.size())
+			{
+				prev = std::move(cur);
+				continue;
+			}
+
+			std::uint64_t executed = 0, waited = 0;
+			for (unsigned bucket = 0; bucket < thread_pool_stats::latency_buckets; ++bucket)
+			{
+				auto count = cur.queue_wait[bucket] - prev.queue_wait[bucket];
+				executed += count;
+				if (bucket > threshold) waited += count;
+			}
+
+			// tasks still running at the end of interval are busy time too, otherwise pool busy with long tasks looks idle
+			thread_pool_stats::duration busy {};
+			for (unsigned idx = 0; idx < nworkers; ++idx)
+			{
+				auto & cw = cur.workers[idx];
+				auto & pw = prev.workers[idx];
+				auto delta = (cw.busy_time + cw.running_time) - (pw.busy_time + pw.running_time);
+				busy += std::max(delta, thread_pool_stats::duration::zero());
+			}
+
+			unsigned target = nworkers;
+			// tasks that are still in queue count as waiting ones
+			waited += cur.queue_depth, executed += cur.queue_depth;
+			if (waited and waited > opts.grow_fraction * executed)
+				target = std::min(opts.max_workers, nworkers + std::max(1u, nworkers / 4));
+			else if (nworkers and 1.0 - double(busy.count()) / (double(elapsed.count()) * nworkers) > opts.shrink_idle)
+				target = std::max(opts.min_workers, nworkers - 1);
+
+			if (target != nworkers)
+			{
+				lk.unlock();
+				set_nworkers(target);
+				lk.lock();
+			}
+
+			prev = stats();
+		}
+	}
+
+	void thread_pool::enable_autoscaling(const thread_pool_autoscale_options & opts)
+	{
+		if (opts.max_workers == 0 or opts.min_workers > opts.max_workers)
+			throw std::invalid_argument("ext::thread_pool::enable_autoscaling: invalid worker bounds");
+
+		std::lock_guard control_lk(m_autoscale_control_mutex);
+		// restart with new options
+		disable_autoscaling_locked();
+
+		auto nworkers = get_nworkers();
+		set_nworkers(std::clamp(nworkers, opts.min_workers, opts.max_workers));
+
+		m_autoscale_stop = false;
+		m_autoscaler = std::thread(&thread_pool::autoscale_func, this, opts);
+	}
+
+	void thread_pool::disable_autoscaling()
+	{
+		std::lock_guard control_lk(m_autoscale_control_mutex);
+		disable_autoscaling_locked();
+	}
+
+	void thread_pool::disable_autoscaling_locked()
+	{
+		if (not m_autoscaler.joinable()) return;
+
+		{
+			std::lock_guard lk(m_autoscale_mutex);
+			m_autoscale_stop = true;
+		}
+
+		m_autoscale_event.notify_one();
+		m_autoscaler.join();
+	}
+
+	void thread_pool::idle_spin(std::unique_lock<std::mutex> & lk, const std::atomic_bool & stop_request)
+	{
+		auto nspins = m_spin_count, nyields = m_yield_count;
+		if (nspins == 0 and nyields == 0) return;
+
+		auto should_stop = [this, &stop_request]
+		{
+			return m_ntasks.load(std::memory_order_relaxed) or (m_ring and not m_ring->empty())
+				or stop_request.load(std::memory_order_relaxed);
+		};
+
+		lk.unlock();
+
+		for (; nspins and not should_stop(); --nspins)
+			cpu_relax();
+
+		if (nspins == 0)
+			for (; nyields and not should_stop(); --nyields)
+				std::this_thread::yield();
+
+		lk.lock();
+	}
+
+	void thread_pool::set_idle_policy(unsigned nspins, unsigned nyields)
+	{
+		std::lock_guard lk(m_mutex);
+		m_spin_count = nspins;
+		m_yield_count = nyields;
+	}
+
+	void thread_pool::enqueue_task(task_base & task) noexcept
+	{
+		auto prio = task.m_priority;
+		m_tasks[static_cast<unsigned>(prio)].push_back(task);
+		m_ntasks.fetch_add(1, std::memory_order_relaxed);
+		if (prio == task_priority::high)
+			m_nhigh.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	auto thread_pool::pop_task() noexcept -> task_base *
+	{
+		// takes task from lane, ring is part of normal lane
+		auto pop = [this](unsigned idx) -> task_base *
+		{
+			auto & lane = m_tasks[idx];
+			if (lane.empty())
+				return idx == static_cast<unsigned>(task_priority::normal) and m_ring ? m_ring->pop() : nullptr;
+
+			auto & task = lane.front();
+			lane.pop_front();
+
+			m_ntasks.fetch_sub(1, std::memory_order_relaxed);
+			if (idx == static_cast<unsigned>(task_priority::high))
+				m_nhigh.fetch_sub(1, std::memory_order_relaxed);
+
+			return &task;
+		};
+
+		if (not m_weighted)
+		{
+			for (unsigned idx = 0; idx < priority_count; ++idx)
+				if (auto * task = pop(idx)) return task;
+
+			return nullptr;
+		}
+
+		// weighted round robin: take from most prioritized non empty lane that still has credits.
+		// If there is no such lane - round is over, credits are restored, and we try again.
+		for (unsigned round = 0; round < 2; ++round)
+		{
+			for (unsigned idx = 0; idx < priority_count; ++idx)
+			{
+				if (m_credits[idx] == 0) continue;
+				if (auto * task = pop(idx))
+				{
+					--m_credits[idx];
+					return task;
+				}
+			}
+
+			m_credits = m_weights;
+		}
+
+		// only lanes with 0 weight are non empty
+		for (unsigned idx = 0; idx < priority_count; ++idx)
+			if (auto * task = pop(idx)) return task;
+
+		return nullptr;
+	}
+
+	auto thread_pool::ring_pop() noexcept -> task_base *
+	{
+		if (not m_ring or m_nhigh.load(std::memory_order_relaxed)) return nullptr;
+		return m_ring->pop();
+	}
+
+	void thread_pool::set_priority_weights(unsigned high, unsigned normal, unsigned background)
+	{
+		std::lock_guard lk(m_mutex);
+		m_weights = {high, normal, background};
+		m_credits = m_weights;
+		m_weighted = high or normal or background;
+	}
+
+	void thread_pool::push_task(task_base * task) noexcept
+	{
+		count_submitted(1);
+		task->m_enqueued = std::chrono::steady_clock::now();
+
+		auto * self = ms_current_worker;
+		// only normal priority tasks go into worker deque, others must be ordered by their lanes
+		if (self and self->m_parent == this and task->m_priority == task_priority::normal)
+		{
+			{
+				std::lock_guard lk(self->m_local_mutex);
+				self->m_local_tasks.push_back(*task);
+				self->m_nlocal.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			// if there are sleeping workers - wake one, it will steal this task.
+			// Sleeping worker holds m_mutex until it waits on m_event, so it will not miss notification.
+			if (m_nsleeping.load(std::memory_order_relaxed))
+			{
+				std::lock_guard lk(m_mutex);
+				m_event.notify_one();
+			}
+
+			return;
+		}
+
+		if (m_ring and task->m_priority == task_priority::normal and m_ring->push(task))
+		{
+			// pairs with fence in worker: either we see it counted as sleeping, or it sees our task in ring.
+			// Counted worker holds m_mutex until it waits on m_event, so it will not miss notification.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_nsleeping.load(std::memory_order_relaxed))
+			{
+				std::lock_guard lk(m_mutex);
+				m_event.notify_one();
+			}
+
+			return;
+		}
+
+		bool notify;
+		{
+			std::lock_guard lk(m_mutex);
+			enqueue_task(*task);
+			notify = m_nsleeping.load(std::memory_order_relaxed) != 0;
+		}
+
+		if (notify) m_event.notify_one();
+	}
+
+	auto thread_pool::steal_task(worker & self) noexcept -> task_base *
+	{
+		for (auto & wptr : m_workers)
+		{
+			if (wptr.get() == &self) continue;
+
+			std::lock_guard lk(wptr->m_local_mutex);
+			auto & tasks = wptr->m_local_tasks;
+			if (tasks.empty()) continue;
+
+			// steal oldest task, owner works with the newest ones
+			auto & task = tasks.front();
+			tasks.pop_front();
+			wptr->m_nlocal.fetch_sub(1, std::memory_order_relaxed);
+			return &task;
+		}
+
+		return nullptr;
+	}
+
+	void thread_pool::push_tasks(task_list_type & tasks, std::size_t count) noexcept
+	{
+		count_submitted(count);
+		auto now = std::chrono::steady_clock::now();
+		for (auto & task : tasks)
+			task.m_enqueued = now;
+
+		auto * self = ms_current_worker;
+		if (self and self->m_parent == this)
+		{
+			{
+				std::lock_guard lk(self->m_local_mutex);
+				self->m_local_tasks.splice(self->m_local_tasks.end(), tasks);
+				self->m_nlocal.fetch_add(count, std::memory_order_relaxed);
+			}
+
+			// wake as much sleeping workers as there are tasks, they will steal them
+			if (std::size_t nsleeping = m_nsleeping.load(std::memory_order_relaxed))
+			{
+				std::lock_guard lk(m_mutex);
+				for (auto n = std::min(count, nsleeping); n; --n)
+					m_event.notify_one();
+			}
+
+			return;
+		}
+
+		std::size_t nsleeping;
+		{
+			std::lock_guard lk(m_mutex);
+			// bulk tasks always have normal priority
+			auto & lane = m_tasks[static_cast<unsigned>(task_priority::normal)];
+			lane.splice(lane.end(), tasks);
+			m_ntasks.fetch_add(count, std::memory_order_relaxed);
+			nsleeping = m_nsleeping.load(std::memory_order_relaxed);
+		}
+
+		if (nsleeping == 0)
+			return;
+		else if (count >= nsleeping)
+			m_event.notify_all();
+		else
+			for (; count; --count)
+				m_event.notify_one();
+	}
+
+	void thread_pool::flush_local_tasks(worker & wrk) noexcept
+	{
+		// only normal priority tasks are placed into worker deque
+		auto & lane = m_tasks[static_cast<unsigned>(task_priority::normal)];
+		std::lock_guard lk(wrk.m_local_mutex);
+		m_ntasks.fetch_add(wrk.m_nlocal.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		lane.splice(lane.end(), wrk.m_local_tasks);
+		wrk.m_nlocal.store(0, std::memory_order_relaxed);
 	}
 
 	void thread_pool::clear() noexcept
@@ -168,24 +1003,48 @@ namespace ext
 				{
 					auto & item = *it;
 					it = m_delayed.erase(it);
+					--m_ndelayed;
 					item.abandone();
 					item.release();
+					m_nabandoned.fetch_add(1, std::memory_order_relaxed);
 				}
 			}
 
 			// wait until all delayed_tasks are finished, and take pending tasks
 			m_event.wait(lk, [this] { return m_delayed_count == 0; });
-			tasks.swap(m_tasks);
+			for (auto & lane : m_tasks)
+				tasks.splice(tasks.end(), lane);
+
+			if (m_ring)
+				while (auto * task = m_ring->pop())
+					tasks.push_back(*task);
+
+			m_nhigh.store(0, std::memory_order_relaxed);
+			m_ntasks.store(0, std::memory_order_relaxed);
+
+			// work stealing mode: take tasks from worker deques too
+			for (auto & wptr : m_workers)
+			{
+				std::lock_guard local_lk(wptr->m_local_mutex);
+				tasks.splice(tasks.end(), wptr->m_local_tasks);
+				wptr->m_nlocal.store(0, std::memory_order_relaxed);
+			}
 		}
 		
-		tasks.clear_and_dispose([](task_base * task)
+		std::uint64_t count = 0;
+		tasks.clear_and_dispose([&count](task_base * task)
 		{
 			task->task_abandone();
 			task->task_release();
+			++count;
 		});
+
+		m_nabandoned.fetch_add(count, std::memory_order_relaxed);
 	}
 
-	thread_pool::thread_pool(unsigned nworkers)
+	thread_pool::thread_pool(unsigned nworkers, thread_pool_flags flags, std::pmr::memory_resource * resource)
+		: m_flags(flags), m_resource(resource),
+		  m_ring(flags & thread_pool_flags::lockfree_queue ? std::make_unique<task_ring>(ring_capacity) : nullptr)
 	{
 		set_nworkers(nworkers);
 	}
@@ -200,6 +1059,9 @@ namespace ext
 		//
 		// TODO: can std::atomic_memory_fence(std::memory_order_acquire/std::memory_order_seq_cst) used?
 
+		// controller must not touch workers anymore
+		disable_autoscaling();
+
 		decltype (m_workers) workers;
 		{
 			std::lock_guard lk(m_mutex);
@@ -222,5 +1084,9 @@ namespace ext
 			worker_ptr->wait();
 			worker_ptr->m_thread.join();
 		}
+
+		// in work stealing mode stopped workers move tasks from their deques into shared list, abandon those too
+		if (m_flags & thread_pool_flags::work_stealing)
+			clear();
 	}
 }
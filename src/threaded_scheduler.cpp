@@ -1,4 +1,9 @@
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <iterator>
 #include <ext/threaded_scheduler.hpp>
+#include <ext/thread_pool.hpp>
 
 namespace ext
 {
@@ -7,7 +12,7 @@ namespace ext
 		// MSVC 2015 and some version of gcc have a bug,
 		// that waiting in std::chrono::steady_clock::time_point::max()
 		// does not work due to integer overflow internally.
-		// 
+		//
 		// Prevent this by returning time_point::max() / 2, value still will be quite a big
 
 		return std::chrono::steady_clock::time_point {
@@ -15,16 +20,530 @@ namespace ext
 		};
 	}
 
-	bool threaded_scheduler::entry_comparer::operator()(const task_ptr & t1, const task_ptr & t2) const noexcept
+	auto threaded_scheduler::coalesce(time_point tp, duration slack) noexcept -> time_point
 	{
-		// priority_queue with std::less provides constant lookup for greatest element, we need smallest
-		return t1->point > t2->point;
+		if (slack <= duration::zero()) return tp;
+
+		// granularity - highest power of 2 not greater than slack,
+		// time point is rounded up to it: result is in [tp, tp + slack] and close time points become equal
+		auto count = slack.count();
+		duration::rep granularity = 1;
+		while (granularity <= count / 2) granularity *= 2;
+
+		auto since = tp.time_since_epoch().count();
+		auto rem = since % granularity;
+		if (rem < 0) rem += granularity;
+		if (rem == 0) return tp;
+
+		return time_point(duration(since - rem + granularity));
+	}
+
+	/************************************************************************/
+	/*                      heap_queue                                      */
+	/************************************************************************/
+	/// binary min-heap of tasks by time point. Every task knows it's position in heap(task_base::index),
+	/// so arbitrary task can be removed in O(log n) on cancellation
+	class threaded_scheduler::heap_queue : public timer_queue
+	{
+		// heap owns references of tasks
+		std::vector<task_base *> m_heap;
+
+	private:
+		void set(std::size_t idx, task_base * task) noexcept { m_heap[idx] = task; task->index = idx; }
+		void sift_up(std::size_t idx) noexcept;
+		void sift_down(std::size_t idx) noexcept;
+		task_base * remove_at(std::size_t idx) noexcept;
+
+	public:
+		void push(task_ptr task) override;
+		task_ptr pop(time_point now) override;
+		time_point next_point() const override;
+		void take_all(std::vector<task_ptr> & tasks) override;
+		task_ptr remove(task_base & task) noexcept override;
+
+	public:
+		~heap_queue() noexcept;
+	};
+
+	threaded_scheduler::heap_queue::~heap_queue() noexcept
+	{
+		std::vector<task_ptr> tasks;
+		take_all(tasks);
+	}
+
+	void threaded_scheduler::heap_queue::sift_up(std::size_t idx) noexcept
+	{
+		auto * task = m_heap[idx];
+		while (idx > 0)
+		{
+			auto parent = (idx - 1) / 2;
+			if (not (task->point < m_heap[parent]->point)) break;
+
+			set(idx, m_heap[parent]);
+			idx = parent;
+		}
+
+		set(idx, task);
+	}
+
+	void threaded_scheduler::heap_queue::sift_down(std::size_t idx) noexcept
+	{
+		auto * task = m_heap[idx];
+		auto size = m_heap.size();
+
+		for (;;)
+		{
+			auto child = idx * 2 + 1;
+			if (child >= size) break;
+			if (child + 1 < size and m_heap[child + 1]->point < m_heap[child]->point) ++child;
+			if (not (m_heap[child]->point < task->point)) break;
+
+			set(idx, m_heap[child]);
+			idx = child;
+		}
+
+		set(idx, task);
+	}
+
+	auto threaded_scheduler::heap_queue::remove_at(std::size_t idx) noexcept -> task_base *
+	{
+		assert(idx < m_heap.size());
+		auto * task = m_heap[idx];
+		auto * last = m_heap.back();
+		m_heap.pop_back();
+
+		if (task != last)
+		{
+			// put last element in place of removed one, it can move either way
+			set(idx, last);
+			if (idx > 0 and last->point < m_heap[(idx - 1) / 2]->point)
+				sift_up(idx);
+			else
+				sift_down(idx);
+		}
+
+		return task;
+	}
+
+	void threaded_scheduler::heap_queue::push(task_ptr task)
+	{
+		m_heap.push_back(task.get());
+		task.release();
+		sift_up(m_heap.size() - 1);
+	}
+
+	auto threaded_scheduler::heap_queue::pop(time_point now) -> task_ptr
+	{
+		if (m_heap.empty() or now < m_heap.front()->point)
+			return nullptr;
+
+		return task_ptr(remove_at(0), ext::noaddref);
+	}
+
+	auto threaded_scheduler::heap_queue::next_point() const -> time_point
+	{
+		return m_heap.empty() ? max_timepoint() : m_heap.front()->point;
+	}
+
+	void threaded_scheduler::heap_queue::take_all(std::vector<task_ptr> & tasks)
+	{
+		tasks.reserve(tasks.size() + m_heap.size());
+		for (auto * task : m_heap)
+			tasks.emplace_back(task, ext::noaddref);
+
+		m_heap.clear();
+	}
+
+	auto threaded_scheduler::heap_queue::remove(task_base & task) noexcept -> task_ptr
+	{
+		assert(task.index < m_heap.size() and m_heap[task.index] == &task);
+		return task_ptr(remove_at(task.index), ext::noaddref);
+	}
+
+	/************************************************************************/
+	/*                      wheel_queue                                     */
+	/************************************************************************/
+	/// Hierarchical timing wheel(Varghese, Lauck): levels of slot rings, every level is slot_count times coarser than previous.
+	/// Task is placed into slot by it's expiration tick: level is chosen by distance from current tick,
+	/// slot - by corresponding bits of expiration tick. When lower level ring wraps - slot of higher level is cascaded:
+	/// it's tasks are re-placed into lower levels. Tasks of current tick slot on level 0 are expired.
+	/// Tasks further than all levels cover are kept in overflow list, re-placed when top level wraps.
+	///
+	/// Ticks without any possible expiration are skipped: if lower levels are empty - wheel jumps right before next cascade.
+	///
+	/// Every task remembers it's list(task_base::index: level * slot_count + slot, or overflow/ready), so it can be unlinked in O(1) on cancellation.
+	class threaded_scheduler::wheel_queue : public timer_queue
+	{
+		typedef std::uint64_t tick_type;
+		typedef boost::intrusive::list<
+			task_base, boost::intrusive::base_hook<hook_type>,
+			boost::intrusive::constant_time_size<true>
+		> task_list;
+
+		static constexpr unsigned slot_bits = 8;
+		static constexpr unsigned slot_count = 1u << slot_bits;
+		static constexpr unsigned slot_mask = slot_count - 1;
+		static constexpr unsigned levels = 4;
+
+		static constexpr std::size_t overflow_index = levels * slot_count;
+		static constexpr std::size_t ready_index = overflow_index + 1;
+
+	private:
+		time_point m_origin;
+		duration m_tick;
+		// current tick, all ticks up to and including it are processed
+		tick_type m_current = 0;
+
+		task_list m_slots[levels][slot_count];
+		// number of tasks on every level, last is overflow list
+		std::size_t m_counts[levels + 1] = {};
+		task_list m_overflow;
+		// expired tasks, waiting for execution
+		task_list m_ready;
+
+	private:
+		static tick_type level_span(unsigned level) noexcept { return tick_type(1) << (slot_bits * level); }
+		tick_type to_tick(time_point tp) const noexcept;
+
+		void place(task_base & task) noexcept;
+		void cascade(task_list & list, std::size_t & count) noexcept;
+		void step() noexcept;
+		void advance(tick_type target) noexcept;
+
+	public:
+		void push(task_ptr task) override { place(*task.release()); }
+		task_ptr pop(time_point now) override;
+		time_point next_point() const override;
+		void take_all(std::vector<task_ptr> & tasks) override;
+		task_ptr remove(task_base & task) noexcept override;
+
+	public:
+		wheel_queue(duration tick);
+		~wheel_queue() noexcept;
+	};
+
+	threaded_scheduler::wheel_queue::wheel_queue(duration tick)
+		: m_origin(time_point::clock::now()), m_tick(tick)
+	{
+		assert(tick.count() > 0);
+	}
+
+	threaded_scheduler::wheel_queue::~wheel_queue() noexcept
+	{
+		// wheel owns references of tasks, normally scheduler takes them all before destruction
+		std::vector<task_ptr> tasks;
+		take_all(tasks);
 	}
 
-	template <class Lock>
-	inline auto threaded_scheduler::next_in(Lock & lk) const noexcept -> time_point
+	auto threaded_scheduler::wheel_queue::to_tick(time_point tp) const noexcept -> tick_type
 	{
-		return m_queue.empty() ? max_timepoint() : m_queue.top()->point;
+		// round up, task must not be executed earlier than requested
+		if (tp <= m_origin) return 0;
+		return static_cast<tick_type>((tp - m_origin + m_tick - duration(1)) / m_tick);
+	}
+
+	void threaded_scheduler::wheel_queue::place(task_base & task) noexcept
+	{
+		auto expire = to_tick(task.point);
+		if (expire <= m_current)
+		{
+			task.index = ready_index;
+			return m_ready.push_back(task);
+		}
+
+		auto delta = expire - m_current;
+		for (unsigned level = 0; level < levels; ++level)
+		{
+			if (delta < level_span(level + 1))
+			{
+				auto slot = (expire >> (slot_bits * level)) & slot_mask;
+				task.index = level * slot_count + slot;
+				m_slots[level][slot].push_back(task);
+				++m_counts[level];
+				return;
+			}
+		}
+
+		task.index = overflow_index;
+		m_overflow.push_back(task);
+		++m_counts[levels];
+	}
+
+	void threaded_scheduler::wheel_queue::cascade(task_list & list, std::size_t & count) noexcept
+	{
+		count -= list.size();
+
+		task_list tasks;
+		tasks.swap(list);
+		tasks.clear_and_dispose([this](task_base * task) { place(*task); });
+	}
+
+	void threaded_scheduler::wheel_queue::step() noexcept
+	{
+		++m_current;
+
+		// lower level ring wrapped - cascade slot of next level
+		unsigned level = 1;
+		for (; level < levels and (m_current & (level_span(level) - 1)) == 0; ++level)
+		{
+			auto slot = (m_current >> (slot_bits * level)) & slot_mask;
+			cascade(m_slots[level][slot], m_counts[level]);
+		}
+
+		// top level wrapped - overflow tasks can be in range now
+		if (level == levels and (m_current & (level_span(levels) - 1)) == 0)
+			cascade(m_overflow, m_counts[levels]);
+
+		auto & slot = m_slots[0][m_current & slot_mask];
+		m_counts[0] -= slot.size();
+		for (auto & task : slot) task.index = ready_index;
+		m_ready.splice(m_ready.end(), slot);
+	}
+
+	void threaded_scheduler::wheel_queue::advance(tick_type target) noexcept
+	{
+		while (m_current < target)
+		{
+			// if levels below L are empty - nothing can expire until next cascade of level L,
+			// jump right before it
+			unsigned level = 0;
+			while (level <= levels and m_counts[level] == 0) ++level;
+
+			if (level > levels)
+			{	// wheel is empty
+				m_current = target;
+				return;
+			}
+
+			if (level > 0)
+			{
+				auto before_cascade = m_current | (level_span(level) - 1);
+				if (before_cascade >= target)
+				{
+					m_current = target;
+					return;
+				}
+
+				m_current = before_cascade;
+			}
+
+			step();
+		}
+	}
+
+	auto threaded_scheduler::wheel_queue::pop(time_point now) -> task_ptr
+	{
+		if (m_ready.empty())
+		{
+			// only fully passed ticks
+			if (now < m_origin) return nullptr;
+			advance(static_cast<tick_type>((now - m_origin) / m_tick));
+			if (m_ready.empty()) return nullptr;
+		}
+
+		auto & task = m_ready.front();
+		m_ready.pop_front();
+		return task_ptr(&task, ext::noaddref);
+	}
+
+	auto threaded_scheduler::wheel_queue::next_point() const -> time_point
+	{
+		// extreme time points can overflow inside wait_until, see max_timepoint
+		if (not m_ready.empty()) return std::chrono::steady_clock::now();
+
+		auto tick_point = [this](tick_type tick) { return m_origin + m_tick * static_cast<duration::rep>(tick); };
+		if (m_counts[0])
+		{
+			// nearest non empty slot of level 0 until ring wraps
+			for (auto tick = m_current + 1; (tick & slot_mask) != 0; ++tick)
+				if (not m_slots[0][tick & slot_mask].empty())
+					return tick_point(tick);
+		}
+
+		// next cascade of lowest non empty level
+		for (unsigned level = 0; level <= levels; ++level)
+			if (m_counts[level])
+				return tick_point((m_current | (level_span(level ? level : 1) - 1)) + 1);
+
+		return max_timepoint();
+	}
+
+	void threaded_scheduler::wheel_queue::take_all(std::vector<task_ptr> & tasks)
+	{
+		auto take = [&tasks](task_list & list)
+		{
+			list.clear_and_dispose([&tasks](task_base * task) { tasks.emplace_back(task, ext::noaddref); });
+		};
+
+		take(m_ready);
+		take(m_overflow);
+		for (auto & level : m_slots)
+			for (auto & slot : level)
+				take(slot);
+
+		std::fill(std::begin(m_counts), std::end(m_counts), 0);
+	}
+
+	auto threaded_scheduler::wheel_queue::remove(task_base & task) noexcept -> task_ptr
+	{
+		task_list * list;
+		if (task.index == ready_index)
+			list = &m_ready;
+		else if (task.index == overflow_index)
+		{
+			list = &m_overflow;
+			--m_counts[levels];
+		}
+		else
+		{
+			auto level = task.index / slot_count;
+			assert(level < levels);
+			list = &m_slots[level][task.index & slot_mask];
+			--m_counts[level];
+		}
+
+		list->erase(list->iterator_to(task));
+		return task_ptr(&task, ext::noaddref);
+	}
+
+	/************************************************************************/
+	/*                      pooled_task/pooled_batch                        */
+	/************************************************************************/
+	/// expired task handed to executor, if executor never executes it(was cleared or destroyed) - task is abandoned
+	class threaded_scheduler::pooled_task
+	{
+	public:
+		task_ptr task;
+
+	public:
+		pooled_task(task_ptr task) noexcept : task(std::move(task)) {}
+		~pooled_task() noexcept { if (task) task->task_abandone(); }
+
+		pooled_task(pooled_task &&) noexcept = default;
+		pooled_task & operator =(pooled_task &&) = delete;
+	};
+
+	/// functor shared by all tasks of one batch submitted to executor, see thread_pool::submit_bulk.
+	/// It's destroyed with last task of batch - that's when scheduler is notified batch is finished
+	class threaded_scheduler::pooled_batch
+	{
+		threaded_scheduler * m_owner;
+
+	public:
+		void operator()(pooled_task item) noexcept { m_owner->execute_pooled(std::move(item.task)); }
+
+	public:
+		pooled_batch(threaded_scheduler * owner) noexcept : m_owner(owner) {}
+		~pooled_batch() noexcept { if (m_owner) m_owner->batch_finished(); }
+
+		pooled_batch(pooled_batch && other) noexcept : m_owner(std::exchange(other.m_owner, nullptr)) {}
+		pooled_batch & operator =(pooled_batch &&) = delete;
+	};
+
+	/************************************************************************/
+	/*                      threaded_scheduler                              */
+	/************************************************************************/
+	void threaded_scheduler::execute_pooled(task_ptr task) noexcept
+	{
+		// batch is alive while it's task executes, so scheduler is alive too
+		task->task_execute();
+		if (not task->task_reschedule())
+			return;
+
+		bool notify;
+		{
+			std::lock_guard lk(m_mutex);
+			notify = requeue(task);
+		}
+
+		if (task)
+			task->task_abandone();
+		else if (notify)
+			m_newdata.notify_one();
+	}
+
+	void threaded_scheduler::batch_finished() noexcept
+	{
+		std::lock_guard lk(m_mutex);
+		--m_nbatches;
+		if (m_stopped and drained())
+			m_newdata.notify_all();
+	}
+
+	bool threaded_scheduler::enqueue(task_ptr task)
+	{
+		auto & ref = *task;
+		m_queue->push(std::move(task));
+
+		ref.linked = true;
+		ref.queued.store(true, std::memory_order_release);
+
+		// scheduler thread is awake, or will wake up before this task anyway - no need to disturb it
+		return ref.point < m_wait_point;
+	}
+
+	bool threaded_scheduler::requeue(task_ptr & task) noexcept
+	{
+		// on failure task is left in task and is abandoned by caller
+		if (m_stopped) return false;
+
+		auto & ref = *task;
+		bool notify;
+		try
+		{
+			notify = enqueue(std::move(task));
+		}
+		catch (...)
+		{
+			return false;
+		}
+
+		// periodic task could be cancelled after reschedule, but before it was marked queued - cancel did not unlink it.
+		// pairs with fence in periodic_task::cancel
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (not ref.task_pending() and ref.queued.exchange(false, std::memory_order_acq_rel))
+		{
+			ref.linked = false;
+			// reference is released by caller outside of lock
+			task = m_queue->remove(ref);
+			return false;
+		}
+
+		return notify;
+	}
+
+	void threaded_scheduler::unqueue(task_base & task) noexcept
+	{
+		task.linked = false;
+		// cancel already took unlinking right - it will come for the task, scheduler must wait for it
+		if (not task.queued.exchange(false, std::memory_order_acq_rel))
+			++m_ncancelling;
+	}
+
+	void threaded_scheduler::unqueue_all(std::vector<task_ptr> & tasks) noexcept
+	{
+		for (auto & task : tasks)
+			unqueue(*task);
+	}
+
+	void threaded_scheduler::cancel_task(task_base & task) noexcept
+	{
+		// reference held by queue, released outside of lock
+		task_ptr item;
+
+		std::lock_guard lk(m_mutex);
+		if (task.linked)
+		{
+			task.linked = false;
+			item = m_queue->remove(task);
+		}
+		else
+		{
+			// scheduler took task out of queue first and accounted us, destructor can be waiting
+			--m_ncancelling;
+			if (m_stopped and drained())
+				m_newdata.notify_all();
+		}
 	}
 
 	void threaded_scheduler::run_passed_events()
@@ -32,21 +551,57 @@ namespace ext
 		auto now = time_point::clock::now();
 		task_ptr item;
 
+		if (m_executor)
+		{
+			// timer thread only manages time: all expired tasks are handed to executor in one batch
+			std::vector<pooled_task> batch;
+			{
+				std::lock_guard lk(m_mutex);
+				while ((item = m_queue->pop(now)))
+				{
+					unqueue(*item);
+					batch.emplace_back(std::move(item));
+				}
+
+				if (batch.empty()) return;
+				++m_nbatches;
+			}
+
+			try
+			{
+				m_executor->submit_bulk(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()), pooled_batch(this));
+			}
+			catch (...)
+			{
+				// not submitted tasks are abandoned by pooled_task, batch is accounted by pooled_batch
+			}
+
+			return;
+		}
+
 		for (;;)
 		{
 			{
 				std::lock_guard lk(m_mutex);
-				if (m_queue.empty()) return;
+				// item is non null only if it's periodic task to be placed back
+				if (item)
+				{
+					requeue(item);
+					if (item) break;
+				}
 
-				auto & top = m_queue.top();
-				if (now < top->point) break;
-			
-				item = std::move(top);
-				m_queue.pop();
+				item = m_queue->pop(now);
+				if (not item) return;
+				unqueue(*item);
 			}
-		
+
 			item->task_execute();
+			if (not item->task_reschedule())
+				item = nullptr;
 		}
+
+		// periodic task was not placed back: scheduler is stopping, cancelled concurrently or not enough memory
+		item->task_abandone();
 	}
 
 	void threaded_scheduler::thread_func()
@@ -58,47 +613,65 @@ namespace ext
 			std::unique_lock lk(m_mutex);
 			if (m_stopped) return;
 
-			auto wait = next_in(lk);
-			m_newdata.wait_until(lk, wait);
+			m_wait_point = m_queue->next_point();
+			// tasks are already due - no need to wait at all
+			if (m_wait_point > std::chrono::steady_clock::now())
+				m_newdata.wait_until(lk, m_wait_point);
+
+			m_wait_point = time_point::min();
 		}
 	}
 
 	void threaded_scheduler::clear() noexcept
 	{
-		queue_type queue;
+		std::vector<task_ptr> tasks;
 		{
 			std::lock_guard lk(m_mutex);
-			queue = std::move(m_queue);
+			m_queue->take_all(tasks);
+			unqueue_all(tasks);
 		}
 
-		while (!queue.empty())
-		{
-			queue.top()->task_abandone();
-			queue.pop();
-		}
+		for (auto & task : tasks)
+			task->task_abandone();
 
 		m_newdata.notify_one();
 	}
 
-	threaded_scheduler::threaded_scheduler()
+	threaded_scheduler::threaded_scheduler(std::pmr::memory_resource * resource)
+		: threaded_scheduler(threaded_scheduler_options {scheduler_backend::heap, std::chrono::milliseconds(1), resource})
+	{
+
+	}
+
+	threaded_scheduler::threaded_scheduler(const threaded_scheduler_options & opts)
+		: m_executor(opts.executor), m_resource(opts.resource)
 	{
+		if (opts.backend == scheduler_backend::timer_wheel)
+			m_queue = std::make_unique<wheel_queue>(opts.tick);
+		else
+			m_queue = std::make_unique<heap_queue>();
+
 		m_thread = std::thread(&threaded_scheduler::thread_func, this);
 	}
 
 	threaded_scheduler::~threaded_scheduler() noexcept
 	{
+		std::vector<task_ptr> tasks;
 		{
 			std::lock_guard lk(m_mutex);
 			m_stopped = true;
-			
-			while (!m_queue.empty())
-			{
-				m_queue.top()->task_abandone();
-				m_queue.pop();
-			}
+			m_queue->take_all(tasks);
+			unqueue_all(tasks);
 		}
-		
+
+		for (auto & task : tasks)
+			task->task_abandone();
+
 		m_newdata.notify_one();
 		m_thread.join();
+
+		// wait for cancellations in flight and batches in executor, they are going to lock m_mutex
+		std::unique_lock lk(m_mutex);
+		m_newdata.wait(lk, [this] { return drained(); });
 	}
 }
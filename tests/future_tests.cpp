@@ -1,9 +1,27 @@
 ﻿#include <future>
+#include <numeric>
+#include <boost/predef.h>
 #include <ext/future.hpp>
+#include <ext/lazy_future.hpp>
 #include <ext/thread_pool.hpp>
 #include <ext/threaded_scheduler.hpp>
+#include <boost/range/irange.hpp>
 #include <boost/test/unit_test.hpp>
 
+#if BOOST_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__cpp_impl_coroutine)
+#include <ext/future_coroutine.hpp>
+#endif
+
+#if defined(EXT_FUTURE_TRACING)
+#include <sstream>
+#include <ext/future_tracing.hpp>
+#endif
+
 struct future_fixture
 {
 	future_fixture()  { ext::init_future_library(); }
@@ -102,6 +120,132 @@ BOOST_AUTO_TEST_CASE(future_broken_tests)
 	);
 }
 
+BOOST_AUTO_TEST_CASE(future_waiter_kind_tests)
+{
+	using namespace std::chrono_literals;
+
+	for (auto kind : {ext::waiter_kind::condvar, ext::waiter_kind::futex})
+	for (unsigned slots : {0u, 4u})
+	{
+		ext::free_future_library();
+		BOOST_REQUIRE(ext::init_future_library(slots, kind));
+
+		// blocking wait, value is set by other thread
+		{
+			ext::promise<int> p;
+			auto f = p.get_future();
+			std::thread thr([&p] { std::this_thread::sleep_for(10ms); p.set_value(42); });
+
+			BOOST_CHECK_EQUAL(f.get(), 42);
+			thr.join();
+		}
+
+		// timeouts
+		{
+			ext::promise<void> p;
+			auto f = p.get_future();
+
+			BOOST_CHECK(f.wait_for(5ms) == ext::future_status::timeout);
+			BOOST_CHECK(f.wait_until(std::chrono::steady_clock::now() + 5ms) == ext::future_status::timeout);
+
+			std::thread thr([&p] { std::this_thread::sleep_for(10ms); p.set_value(); });
+			BOOST_CHECK(f.wait_for(10s) == ext::future_status::ready);
+			thr.join();
+		}
+
+		// multiple threads waiting on same waiter
+		{
+			ext::promise<int> p;
+			ext::shared_future<int> f = p.get_future();
+			std::atomic_int sum = 0;
+
+			std::vector<std::thread> threads;
+			for (unsigned u = 0; u < 4; ++u)
+				threads.emplace_back([f, &sum]() mutable { sum += f.get(); });
+
+			std::this_thread::sleep_for(10ms);
+			p.set_value(1);
+			for (auto & thr : threads) thr.join();
+
+			BOOST_CHECK_EQUAL(sum.load(), 4);
+		}
+
+		// many short waits, exhausting waiters arena
+		{
+			std::vector<ext::promise<int>> promises(16);
+			std::vector<ext::future<int>> futures;
+			for (auto & p : promises) futures.push_back(p.get_future());
+
+			std::thread thr([&promises]
+			{
+				int val = 0;
+				for (auto & p : promises) p.set_value(val++);
+			});
+
+			int sum = 0;
+			for (auto & f : futures) sum += f.get();
+			thr.join();
+
+			BOOST_CHECK_EQUAL(sum, 15 * 16 / 2);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(future_waiter_kind_benchmark,
+	* boost::unit_test::disabled()
+	* boost::unit_test::description("Compares condvar and futex waiters, run explicitly with --run_test=future_tests/future_waiter_kind_benchmark --log_level=message"))
+{
+	// consumer blocks on get() of a future, completed by producer thread after delay busy loop iterations.
+	// Spin phase of futex waiter is used only on multi cpu machines
+	const unsigned iterations = 2000;
+	BOOST_TEST_MESSAGE("hardware_concurrency: " << std::thread::hardware_concurrency());
+
+	for (unsigned delay : {0u, 200u, 5000u, 100000u})
+	for (auto kind : {ext::waiter_kind::condvar, ext::waiter_kind::futex})
+	{
+		ext::free_future_library();
+		BOOST_REQUIRE(ext::init_future_library(0, kind));
+
+		std::atomic<ext::promise<int> *> handoff = nullptr;
+		std::atomic_bool stop = false;
+		std::thread producer([&handoff, &stop, delay]
+		{
+			while (not stop.load())
+			{
+				auto * p = handoff.exchange(nullptr);
+				if (not p)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				// producer owns promise: it's still used by set_value after consumer was woken
+				for (volatile unsigned n = 0; n < delay; n = n + 1) {}
+				p->set_value(1);
+				delete p;
+			}
+		});
+
+		int sum = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned u = 0; u < iterations; ++u)
+		{
+			auto * p = new ext::promise<int>;
+			auto f = p->get_future();
+			handoff.store(p);
+			sum += f.get();
+		}
+
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		stop = true;
+		producer.join();
+
+		BOOST_CHECK_EQUAL(sum, int(iterations));
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / iterations;
+		BOOST_TEST_MESSAGE("delay " << delay << ", " << (kind == ext::waiter_kind::futex ? "futex" : "condvar") << ": " << ns << " ns per wait");
+	}
+}
+
 BOOST_AUTO_TEST_CASE(future_when_all_tests)
 {
 	using namespace std;
@@ -179,6 +323,388 @@ BOOST_AUTO_TEST_CASE(future_when_any_tests)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(future_when_bulk_tests)
+{
+	const std::size_t count = 1000;
+	ext::thread_pool pool(4);
+
+	// when_all over big set, some futures are already ready or deferred
+	{
+		std::vector<ext::promise<int>> promises(count);
+		std::vector<ext::future<int>> futures;
+		for (std::size_t idx = 0; idx < count; ++idx)
+		{
+			if (idx % 100 == 0)
+				futures.push_back(ext::async(ext::launch::deferred, [idx] { return int(idx); }));
+			else if (idx % 100 == 1)
+				futures.push_back(ext::make_ready_future(int(idx)));
+			else
+				futures.push_back(promises[idx].get_future());
+		}
+
+		auto fall = ext::when_all(std::make_move_iterator(futures.begin()), std::make_move_iterator(futures.end()));
+		BOOST_CHECK(fall.is_pending());
+
+		std::vector<ext::future<void>> setters;
+		for (std::size_t idx = 0; idx < count; ++idx)
+		{
+			if (idx % 100 > 1)
+				setters.push_back(pool.submit([&promises, idx] { promises[idx].set_value(int(idx)); }));
+		}
+
+		auto res = fall.get();
+		BOOST_REQUIRE_EQUAL(res.size(), count);
+
+		long sum = 0;
+		for (auto & f : res) sum += f.get();
+		BOOST_CHECK_EQUAL(sum, long(count * (count - 1) / 2));
+
+		for (auto & f : setters) f.get();
+	}
+
+	// when_any over big set
+	{
+		std::vector<ext::promise<int>> promises(count);
+		std::vector<ext::shared_future<int>> futures;
+		for (auto & p : promises) futures.push_back(p.get_future());
+
+		auto fany = ext::when_any(futures.begin(), futures.end());
+		BOOST_CHECK(fany.is_pending());
+
+		promises[500].set_value(500);
+		auto res = fany.get();
+		BOOST_CHECK_EQUAL(res.index, 500u);
+		BOOST_CHECK_EQUAL(res.futures[res.index].get(), 500);
+	}
+
+	// as_completed: futures are yielded in order of completion
+	{
+		std::vector<ext::promise<int>> promises(count);
+		std::vector<ext::future<int>> futures;
+		for (auto & p : promises) futures.push_back(p.get_future());
+
+		auto range = ext::as_completed(std::make_move_iterator(futures.begin()), std::make_move_iterator(futures.end()));
+		BOOST_CHECK_EQUAL(range.size(), count);
+
+		// complete in reverse order
+		std::thread thr([&promises]
+		{
+			for (auto it = promises.rbegin(); it != promises.rend(); ++it)
+				it->set_value(int(promises.rend() - it - 1));
+		});
+
+		int expected = int(count) - 1;
+		bool ordered = true;
+		for (auto & f : range)
+			ordered &= f.get() == expected--;
+
+		thr.join();
+		BOOST_CHECK(ordered);
+		BOOST_CHECK_EQUAL(expected, -1);
+		BOOST_CHECK(range.all().is_ready());
+	}
+
+	// as_completed with abandoned promises and empty range
+	{
+		ext::as_completed_range<ext::future<int>> range;
+		{
+			ext::promise<int> p1, p2;
+			std::vector<ext::future<int>> futures;
+			futures.push_back(p1.get_future());
+			futures.push_back(p2.get_future());
+
+			range = ext::as_completed(std::make_move_iterator(futures.begin()), std::make_move_iterator(futures.end()));
+			p2.set_value(2);
+		}
+
+		auto it = range.begin();
+		BOOST_CHECK_EQUAL(it->get(), 2);
+		++it;
+		BOOST_CHECK(it->is_abandoned());
+
+		std::vector<ext::future<int>> empty;
+		auto erange = ext::as_completed(std::make_move_iterator(empty.begin()), std::make_move_iterator(empty.end()));
+		BOOST_CHECK(erange.begin() == erange.end());
+		BOOST_CHECK(erange.all().is_ready());
+	}
+
+	// as_completed with concurrent waiters on different positions: every waiter must be woken
+	{
+		ext::promise<int> p1, p2;
+		std::vector<ext::future<int>> futures;
+		futures.push_back(p1.get_future());
+		futures.push_back(p2.get_future());
+		auto range = ext::as_completed(std::make_move_iterator(futures.begin()), std::make_move_iterator(futures.end()));
+
+		std::atomic_bool first_done = false;
+		std::thread second_waiter([&range] { range.wait_completed(1); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		std::thread first_waiter([&range, &first_done] { range.wait_completed(0); first_done = true; });
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+		p1.set_value(1);
+		for (unsigned u = 0; u < 1000 and not first_done; ++u)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		BOOST_CHECK(first_done);
+		p2.set_value(2);
+
+		first_waiter.join();
+		second_waiter.join();
+	}
+}
+
+BOOST_AUTO_TEST_CASE(future_stop_token_tests)
+{
+	// stop_source/stop_callback basics
+	{
+		ext::stop_source source;
+		auto token = source.get_token();
+		BOOST_CHECK(token.stop_possible());
+		BOOST_CHECK(not ext::stop_token().stop_possible());
+
+		int called = 0, dropped = 0;
+		ext::stop_callback cb1(token, [&called] { ++called; });
+		{
+			ext::stop_callback cb2(token, [&dropped] { ++dropped; });
+		}
+
+		BOOST_CHECK(source.request_stop());
+		BOOST_CHECK(not source.request_stop());
+		BOOST_CHECK(token.stop_requested());
+		BOOST_CHECK_EQUAL(called, 1);
+		BOOST_CHECK_EQUAL(dropped, 0);
+
+		// registered after stop - invoked immediately
+		ext::stop_callback cb3(token, [&called] { ++called; });
+		BOOST_CHECK_EQUAL(called, 2);
+	}
+
+	// queued thread_pool tasks are cancelled and never executed, running one polls token
+	{
+		ext::thread_pool pool(1);
+		ext::stop_source source;
+		ext::promise<void> started, gate;
+		auto gate_future = gate.get_future().share();
+
+		auto running = pool.submit(source.get_token(), [&started, gate_future](const ext::stop_token & token) mutable
+		{
+			started.set_value();
+			gate_future.wait();
+			return token.stop_requested();
+		});
+
+		std::atomic_int executed = 0;
+		std::vector<ext::future<void>> queued;
+		for (int i = 0; i < 10; ++i)
+			queued.push_back(pool.submit(source.get_token(), [&executed] { ++executed; }));
+
+		started.get_future().wait();
+		source.request_stop();
+		for (auto & f : queued)
+			BOOST_CHECK(f.is_cancelled());
+
+		gate.set_value();
+		BOOST_CHECK(running.get());
+
+		// pool drops cancelled tasks and goes on
+		BOOST_CHECK_EQUAL(pool.submit([] { return 1; }).get(), 1);
+		BOOST_CHECK_EQUAL(executed.load(), 0);
+	}
+
+	// then with stop token
+	{
+		ext::stop_source source;
+		ext::promise<int> p;
+		bool called = false;
+		auto f = p.get_future().then(source.get_token(), [&called](auto f) { called = true; return f.get(); });
+
+		source.request_stop();
+		BOOST_CHECK(f.is_cancelled());
+		p.set_value(1);
+		BOOST_CHECK(not called);
+
+		// satisfied before stop - unaffected, late stop does nothing
+		ext::stop_source source2;
+		ext::promise<int> p2;
+		auto f2 = p2.get_future().then(source2.get_token(), [](auto f) { return f.get() + 1; });
+		p2.set_value(1);
+		source2.request_stop();
+		BOOST_CHECK_EQUAL(f2.get(), 2);
+	}
+
+	// when_all/when_any with stop token cancel their inputs
+	{
+		ext::stop_source source;
+		ext::promise<int> p1, p2, p3;
+		p1.set_value(1);
+
+		std::vector<ext::future<int>> futures;
+		futures.push_back(p1.get_future());
+		futures.push_back(p2.get_future());
+		auto fall = ext::when_all(source.get_token(), std::make_move_iterator(futures.begin()), std::make_move_iterator(futures.end()));
+		auto fany = ext::when_any(source.get_token(), p3.get_future());
+		BOOST_CHECK(fall.is_pending());
+		BOOST_CHECK(fany.is_pending());
+
+		source.request_stop();
+		BOOST_REQUIRE(fall.is_ready());
+		BOOST_REQUIRE(fany.is_ready());
+
+		auto all = fall.get();
+		BOOST_CHECK_EQUAL(all[0].get(), 1);
+		BOOST_CHECK(all[1].is_cancelled());
+		BOOST_CHECK(std::get<0>(fany.get().futures).is_cancelled());
+	}
+
+	// cancellation of parent future requests stop for all linked work
+	{
+		ext::thread_pool pool(1);
+		ext::stop_source source;
+		ext::promise<void> gate;
+		auto blocker = pool.submit([f = gate.get_future()]() mutable { f.wait(); });
+
+		std::vector<ext::shared_future<int>> children;
+		for (int i = 0; i < 5; ++i)
+			children.push_back(pool.submit(source.get_token(), [i] { return i; }).share());
+
+		auto request = ext::when_all(source.get_token(), children.begin(), children.end())
+			.then([](auto f) { return f.get().size(); });
+		ext::request_stop_on_cancel(request, source);
+
+		request.cancel();
+		BOOST_CHECK(source.stop_requested());
+		for (auto & child : children)
+			BOOST_CHECK(child.is_cancelled());
+
+		gate.set_value();
+		blocker.get();
+	}
+}
+
+BOOST_AUTO_TEST_CASE(lazy_future_tests)
+{
+	using namespace std;
+
+	// nothing is executed until materialized
+	{
+		unsigned calls = 0;
+		auto pipeline = ext::lazy([&calls](int x) { ++calls; return x + 1; }, 1)
+			.then([&calls](int x) { ++calls; return to_string(x * 2); })
+			.then([&calls](string s) { ++calls; return s + "!"; });
+
+		BOOST_CHECK_EQUAL(calls, 0u);
+		BOOST_CHECK_EQUAL(std::move(pipeline).get(), "4!");
+		BOOST_CHECK_EQUAL(calls, 3u);
+	}
+
+	// void steps, deferred materialization
+	{
+		int val = 0;
+		auto f = ext::lazy([&val] { val = 10; })
+			.then([&val] { return val * 2; })
+			.materialize();
+
+		BOOST_CHECK(f.is_deferred());
+		BOOST_CHECK_EQUAL(val, 0);
+		BOOST_CHECK_EQUAL(f.get(), 20);
+	}
+
+	// exception stops pipeline
+	{
+		bool executed = false;
+		auto f = ext::lazy([]() -> int { throw std::runtime_error("fail"); })
+			.then([&executed](int x) { executed = true; return x; })
+			.materialize(ext::launch::async);
+
+		BOOST_CHECK_THROW(f.get(), std::runtime_error);
+		BOOST_CHECK(not executed);
+	}
+
+	// pipeline from future - single continuation
+	{
+		ext::promise<int> p;
+		auto f = ext::lazy(p.get_future())
+			.then([](int x) { return x * 3; })
+			.then([](int x) { return x + 1; })
+			.materialize();
+
+		BOOST_CHECK(f.is_pending());
+		p.set_value(2);
+		BOOST_CHECK_EQUAL(f.get(), 7);
+	}
+
+	// from shared_future, inline get
+	{
+		ext::shared_future<string> sf = ext::make_ready_future("abc"s);
+		auto res = ext::lazy(sf).then([](string s) { return s.size(); }).get();
+		BOOST_CHECK_EQUAL(res, 3u);
+		BOOST_CHECK_EQUAL(sf.get(), "abc");
+	}
+
+	// executor
+	{
+		ext::thread_pool pool(2);
+		auto f1 = ext::lazy([] { return 5; }).then([](int x) { return x * x; }).submit(pool);
+		BOOST_CHECK_EQUAL(f1.get(), 25);
+
+		ext::promise<int> p;
+		auto f2 = ext::lazy(p.get_future()).then([](int x) { return x - 1; }).submit(pool);
+		p.set_value(10);
+		BOOST_CHECK_EQUAL(f2.get(), 9);
+	}
+}
+
+#if defined(EXT_FUTURE_TRACING)
+BOOST_AUTO_TEST_CASE(future_tracing_tests)
+{
+	using event_kind = ext::chrome_trace_recorder::event_kind;
+	ext::chrome_trace_recorder recorder;
+	ext::set_future_tracer(&recorder);
+
+	{
+		ext::thread_pool pool(2);
+		auto f1 = pool.submit([] { return 1; });
+		auto f2 = pool.submit([] { return 2; });
+		auto fc = f1.then([](auto f) { return f.get() + 10; });
+
+		auto all = ext::when_all(std::move(fc), std::move(f2));
+		auto res = all.get();
+		BOOST_CHECK_EQUAL(std::get<0>(res).get() + std::get<1>(res).get(), 13);
+	}
+
+	ext::set_future_tracer(nullptr);
+	auto events = recorder.events();
+
+	auto count = [&events](event_kind kind)
+	{
+		return std::count_if(events.begin(), events.end(), [kind](auto & ev) { return ev.kind == kind; });
+	};
+
+	BOOST_CHECK_GE(count(event_kind::created), 4);
+	BOOST_CHECK_GE(count(event_kind::satisfied), 4);
+	// 2 thread_pool tasks and continuation task
+	BOOST_CHECK_EQUAL(count(event_kind::execution), 3);
+	BOOST_CHECK_GE(count(event_kind::continuation), 3);
+
+	for (auto & ev : events)
+	{
+		BOOST_CHECK_NE(ev.state, 0u);
+		if (ev.kind == event_kind::continuation) BOOST_CHECK_NE(ev.caller, 0u);
+		if (ev.kind == event_kind::execution or ev.kind == event_kind::continuation)
+			BOOST_CHECK(ev.start <= ev.finish);
+	}
+
+	std::ostringstream os;
+	recorder.write_json(os);
+	auto json = os.str();
+
+	BOOST_CHECK(json.find("\"traceEvents\"") != json.npos);
+	BOOST_CHECK(json.find("ext::thread_pool::task_impl") != json.npos);
+	BOOST_CHECK(json.find("\"ph\":\"f\"") != json.npos);
+}
+#endif
+
 BOOST_AUTO_TEST_CASE(future_deferred_tests)
 {
 	auto f = ext::async(ext::launch::deferred, [] { return 12u; });
@@ -335,6 +861,114 @@ BOOST_AUTO_TEST_CASE(thread_pool_result_type_tests)
 	BOOST_CHECK_EQUAL(pool.submit(f, tricky_functor()).get(), 3);
 }
 
+#if defined(__cpp_impl_coroutine)
+namespace
+{
+	// minimal coroutine type, not related to ext::future
+	struct detached_coroutine
+	{
+		struct promise_type
+		{
+			detached_coroutine get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+
+	ext::future<int> coro_add(ext::future<int> f1, ext::shared_future<int> f2)
+	{
+		int a = co_await std::move(f1);
+		int b = co_await f2;
+		co_return a + b;
+	}
+
+	ext::future<void> coro_throw(ext::future<int> f)
+	{
+		co_await std::move(f);
+		throw std::runtime_error("coro");
+	}
+
+	ext::future<int> coro_chain(ext::thread_pool & pool, int depth)
+	{
+		if (depth == 0) co_return co_await pool.submit([] { return 1; });
+		co_return 1 + co_await coro_chain(pool, depth - 1);
+	}
+
+	detached_coroutine coro_detached(ext::future<int> f, std::atomic_int & result)
+	{
+		result = co_await std::move(f);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(future_coroutine_tests)
+{
+	using namespace std::chrono_literals;
+
+	// not ready futures, satisfied from other thread
+	{
+		ext::promise<int> p1, p2;
+		auto f = coro_add(p1.get_future(), p2.get_future().share());
+		BOOST_CHECK(f.is_pending());
+
+		std::thread thr([&] { p1.set_value(1); std::this_thread::sleep_for(1ms); p2.set_value(2); });
+		BOOST_CHECK_EQUAL(f.get(), 3);
+		thr.join();
+	}
+
+	// ready futures - coroutine completes synchronously
+	{
+		auto f = coro_add(ext::make_ready_future(10), ext::make_ready_future(20).share());
+		BOOST_CHECK(f.is_ready());
+		BOOST_CHECK_EQUAL(f.get(), 30);
+	}
+
+	// exceptions of awaited future and of coroutine itself
+	{
+		ext::promise<int> p;
+		auto f = coro_throw(p.get_future());
+		p.set_value(1);
+		BOOST_CHECK_THROW(f.get(), std::runtime_error);
+
+		auto g = coro_add(ext::make_exceptional_future<int>(std::logic_error("err")), ext::make_ready_future(1).share());
+		BOOST_CHECK_THROW(g.get(), std::logic_error);
+	}
+
+	// abandoned awaited future
+	{
+		ext::future<void> f;
+		{
+			ext::promise<int> p;
+			f = coro_throw(p.get_future());
+		}
+
+		BOOST_CHECK_THROW(f.get(), ext::future_error);
+	}
+
+	// deep chains on thread_pool
+	{
+		ext::thread_pool pool(4);
+		std::vector<ext::future<int>> futures;
+		for (int i = 0; i < 200; ++i)
+			futures.push_back(coro_chain(pool, 20));
+
+		for (auto & f : futures)
+			BOOST_CHECK_EQUAL(f.get(), 21);
+	}
+
+	// other coroutine types can await ext futures
+	{
+		std::atomic_int result = 0;
+		ext::promise<int> p;
+		coro_detached(p.get_future(), result);
+		BOOST_CHECK_EQUAL(result, 0);
+		p.set_value(5);
+		BOOST_CHECK_EQUAL(result, 5);
+	}
+}
+#endif
+
 BOOST_AUTO_TEST_CASE(threaded_scheduler_result_type_tests)
 {
 	tricky_functor func;
@@ -348,6 +982,269 @@ BOOST_AUTO_TEST_CASE(threaded_scheduler_result_type_tests)
 
 
 
+BOOST_AUTO_TEST_CASE(threaded_scheduler_timer_wheel_tests)
+{
+	using namespace std::chrono_literals;
+	using clock = std::chrono::steady_clock;
+
+	for (auto tick : {clock::duration(1ms), clock::duration(1us)})
+	{
+		ext::threaded_scheduler_options opts;
+		opts.backend = ext::scheduler_backend::timer_wheel;
+		opts.tick = tick;
+		ext::threaded_scheduler scheduler(opts);
+
+		// various distances: level 0, higher levels(with 1us tick), past time points
+		std::vector<ext::future<bool>> futures;
+		for (unsigned u = 0; u < 500; ++u)
+		{
+			auto tp = clock::now() + std::chrono::microseconds((u * 7919) % 150000) - 1ms;
+			futures.push_back(scheduler.submit(tp, [tp] { return clock::now() >= tp; }));
+		}
+
+		for (auto & f : futures)
+			BOOST_CHECK(f.get());
+
+		// far task is abandoned on clear
+		auto far = scheduler.submit(1h, [] { return 1; });
+		auto near = scheduler.submit(1ms, [] { return 2; });
+		BOOST_CHECK_EQUAL(near.get(), 2);
+
+		scheduler.clear();
+		BOOST_CHECK(far.is_abandoned());
+	}
+
+	// ordering of tasks in different ticks is preserved
+	{
+		ext::threaded_scheduler scheduler(ext::threaded_scheduler_options {ext::scheduler_backend::timer_wheel, 1ms});
+		std::string order;
+		auto now = clock::now();
+		auto f3 = scheduler.submit(now + 30ms, [&order] { order += '3'; });
+		auto f1 = scheduler.submit(now + 10ms, [&order] { order += '1'; });
+		auto f2 = scheduler.submit(now + 20ms, [&order] { order += '2'; });
+
+		f3.wait();
+		BOOST_CHECK_EQUAL(order, "123");
+	}
+}
+
+BOOST_AUTO_TEST_CASE(threaded_scheduler_cancellation_tests)
+{
+	using namespace std::chrono_literals;
+
+	for (auto backend : {ext::scheduler_backend::heap, ext::scheduler_backend::timer_wheel})
+	{
+		ext::threaded_scheduler scheduler(ext::threaded_scheduler_options {backend});
+
+		// cancelled task is unlinked from scheduler immediately: it's functor is destroyed with last future
+		auto marker = std::make_shared<int>(0);
+		std::vector<ext::future<int>> futures;
+		for (unsigned u = 0; u < 1000; ++u)
+			futures.push_back(scheduler.submit(1h + std::chrono::milliseconds(u % 37), [marker] { return 1; }));
+
+		auto near = scheduler.submit(10ms, [marker] { return 2; });
+		for (auto & f : futures)
+			BOOST_CHECK(f.cancel());
+
+		futures.clear();
+		BOOST_CHECK_EQUAL(marker.use_count(), 2);
+
+		// remaining tasks are not affected
+		BOOST_CHECK_EQUAL(near.get(), 2);
+		near = {};
+		BOOST_CHECK_EQUAL(marker.use_count(), 1);
+
+		// executed task can not be cancelled
+		auto done = scheduler.submit(0ms, [] { return 3; });
+		done.wait();
+		BOOST_CHECK(not done.cancel());
+		BOOST_CHECK_EQUAL(done.get(), 3);
+	}
+
+	// cancellation racing with execution and scheduler destruction
+	for (unsigned n = 0; n < 50; ++n)
+	{
+		std::vector<ext::future<int>> futures;
+		std::atomic_uint executed = 0;
+		{
+			ext::threaded_scheduler scheduler;
+			for (unsigned u = 0; u < 100; ++u)
+				futures.push_back(scheduler.submit(std::chrono::microseconds(u * 10), [&executed] { ++executed; return 1; }));
+
+			std::thread canceller([&futures] { for (auto & f : futures) f.cancel(); });
+			std::this_thread::sleep_for(std::chrono::microseconds(n * 10));
+			canceller.join();
+		}
+
+		unsigned cancelled = 0;
+		for (auto & f : futures)
+			cancelled += f.is_cancelled();
+
+		BOOST_CHECK_EQUAL(cancelled + executed + std::count_if(futures.begin(), futures.end(), [](auto & f) { return f.is_abandoned(); }), 100u);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(threaded_scheduler_periodic_tests)
+{
+	using namespace std::chrono_literals;
+	using clock = std::chrono::steady_clock;
+
+	for (auto backend : {ext::scheduler_backend::heap, ext::scheduler_backend::timer_wheel})
+	{
+		ext::threaded_scheduler scheduler(ext::threaded_scheduler_options {backend});
+
+		// fixed rate: runs are aligned to schedule
+		std::atomic_uint count = 0;
+		auto start = clock::now();
+		std::vector<clock::time_point> points;
+		auto f = scheduler.submit_periodic(start + 5ms, 5ms, [&] { points.push_back(clock::now()); ++count; });
+
+		while (count < 10) std::this_thread::sleep_for(1ms);
+		BOOST_CHECK(f.cancel());
+		BOOST_CHECK(f.is_cancelled());
+
+		// run in progress is not interrupted
+		std::this_thread::sleep_for(10ms);
+		auto last = count.load();
+		std::this_thread::sleep_for(20ms);
+		BOOST_CHECK_EQUAL(count, last);
+
+		for (std::size_t i = 0; i < points.size(); ++i)
+			BOOST_CHECK(points[i] >= start + 5ms * (i + 1));
+
+		// fixed delay, stopped by exception
+		unsigned runs = 0;
+		auto g = scheduler.submit_periodic(1ms, [&runs] { if (++runs == 5) throw std::runtime_error("stop"); }, ext::periodic_mode::fixed_delay);
+		BOOST_CHECK_THROW(g.get(), std::runtime_error);
+		BOOST_CHECK_EQUAL(runs, 5);
+
+		// abandoned on clear
+		auto h = scheduler.submit_periodic(1h, [] {});
+		scheduler.clear();
+		BOOST_CHECK(h.is_abandoned());
+
+		BOOST_CHECK_THROW(scheduler.submit_periodic(0ms, [] {}), std::invalid_argument);
+	}
+
+	// slow functor: missed fixed rate runs are skipped
+	{
+		ext::threaded_scheduler scheduler;
+		std::atomic_uint count = 0;
+		auto f = scheduler.submit_periodic(1ms, [&count] { ++count; std::this_thread::sleep_for(10ms); });
+		std::this_thread::sleep_for(55ms);
+		f.cancel();
+		BOOST_CHECK_LE(count, 7u);
+	}
+
+	// cancellation racing with rescheduling and scheduler destruction
+	for (unsigned n = 0; n < 50; ++n)
+	{
+		std::vector<ext::future<void>> futures;
+		{
+			ext::threaded_scheduler scheduler;
+			for (unsigned u = 0; u < 20; ++u)
+				futures.push_back(scheduler.submit_periodic(std::chrono::microseconds(u + 1), [] {}));
+
+			std::this_thread::sleep_for(std::chrono::microseconds(n * 20));
+			for (unsigned u = 0; u < futures.size(); u += 2)
+				futures[u].cancel();
+		}
+
+		for (auto & f : futures)
+			BOOST_CHECK(f.is_cancelled() or f.is_abandoned());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(threaded_scheduler_executor_tests)
+{
+	using namespace std::chrono_literals;
+	using clock = std::chrono::steady_clock;
+
+	ext::thread_pool pool(4);
+	for (auto backend : {ext::scheduler_backend::heap, ext::scheduler_backend::timer_wheel})
+	{
+		ext::threaded_scheduler_options opts;
+		opts.backend = backend;
+		opts.executor = &pool;
+		ext::threaded_scheduler scheduler(opts);
+		BOOST_CHECK_EQUAL(scheduler.executor(), &pool);
+
+		// slow task does not delay other timers
+		auto start = clock::now();
+		auto slow = scheduler.submit(1ms, [] { std::this_thread::sleep_for(300ms); return std::this_thread::get_id(); });
+		auto fast = scheduler.submit(10ms, [] { return clock::now(); });
+		BOOST_CHECK(fast.get() - start < 200ms);
+		BOOST_CHECK(slow.get() != std::this_thread::get_id());
+
+		// batch of expired tasks
+		std::vector<ext::future<int>> futures;
+		auto tp = clock::now() + 5ms;
+		for (int i = 0; i < 100; ++i)
+			futures.push_back(scheduler.submit(tp, [i] { return i; }));
+
+		int sum = 0;
+		for (auto & f : futures) sum += f.get();
+		BOOST_CHECK_EQUAL(sum, 4950);
+
+		// periodic task is placed back from pool thread
+		std::atomic_uint count = 0;
+		auto periodic = scheduler.submit_periodic(2ms, [&count] { ++count; });
+		while (count < 5) std::this_thread::sleep_for(1ms);
+		BOOST_CHECK(periodic.cancel());
+	}
+
+	// tasks handed to executor, but never executed, are abandoned
+	{
+		ext::thread_pool busy(1);
+		auto blocker = busy.submit([] { std::this_thread::sleep_for(50ms); });
+
+		ext::threaded_scheduler_options opts;
+		opts.executor = &busy;
+		ext::threaded_scheduler scheduler(opts);
+
+		auto f = scheduler.submit(1ms, [] { return 1; });
+		std::this_thread::sleep_for(20ms);
+		busy.clear();
+		BOOST_CHECK(f.is_abandoned());
+		blocker.wait();
+	}
+}
+
+BOOST_AUTO_TEST_CASE(threaded_scheduler_slack_tests)
+{
+	using namespace std::chrono_literals;
+	using clock = std::chrono::steady_clock;
+
+	ext::threaded_scheduler scheduler;
+	auto start = clock::now();
+
+	// tasks are never executed earlier than requested, and not much later than slack allows
+	std::vector<ext::future<clock::duration>> futures;
+	for (unsigned u = 0; u < 1000; ++u)
+	{
+		auto tp = start + 20ms + std::chrono::microseconds(u * 13 % 10000);
+		futures.push_back(scheduler.submit_with_slack(tp, 16ms, [tp] { return clock::now() - tp; }));
+	}
+
+	for (auto & f : futures)
+	{
+		auto late = f.get();
+		BOOST_CHECK(late >= 0ms);
+		BOOST_CHECK(late < 16ms + 100ms);
+	}
+
+	// zero slack is plain submit
+	auto tp = clock::now() + 5ms;
+	auto f = scheduler.submit_with_slack(tp, 0ms, [] { return clock::now(); });
+	BOOST_CHECK(f.get() >= tp);
+
+	// earlier task still wakes up scheduler sleeping for later one
+	auto far = scheduler.submit(1h, [] {});
+	auto near = scheduler.submit_with_slack(5ms, 1ms, [] { return 1; });
+	BOOST_CHECK(near.wait_for(1s) == ext::future_status::ready);
+	far.cancel();
+}
+
 BOOST_AUTO_TEST_CASE(thread_pool_tests)
 {
 	using namespace std::chrono_literals;
@@ -361,4 +1258,569 @@ BOOST_AUTO_TEST_CASE(thread_pool_tests)
 	BOOST_CHECK_EQUAL(result, 122);
 }
 
+BOOST_AUTO_TEST_CASE(thread_pool_work_stealing_tests)
+{
+	{
+		ext::thread_pool pool(4, ext::thread_pool_flags::work_stealing);
+		std::atomic_uint counter = 0;
+
+		// tasks submitted from worker threads go into worker deques
+		auto spawn = [&pool, &counter]
+		{
+			std::vector<ext::future<void>> futures;
+			for (unsigned u = 0; u < 100; ++u)
+				futures.push_back(pool.submit([&counter] { counter.fetch_add(1, std::memory_order_relaxed); }));
+
+			return futures;
+		};
+
+		std::vector<ext::future<std::vector<ext::future<void>>>> outer;
+		for (unsigned u = 0; u < 10; ++u)
+			outer.push_back(pool.submit(spawn));
+
+		for (auto & f : outer)
+			for (auto & inner : f.get())
+				inner.get();
+
+		BOOST_CHECK_EQUAL(counter.load(), 1000);
+	}
+
+	// tasks left in deque of stopped worker are not lost
+	{
+		ext::thread_pool pool(1, ext::thread_pool_flags::work_stealing);
+		auto f = pool.submit([&pool]
+		{
+			auto inner = pool.submit([] { return 12; });
+			return std::make_pair(std::move(inner), pool.set_nworkers(0));
+		});
+
+		auto [inner, stopped] = f.get();
+		stopped.wait();
+		BOOST_CHECK(inner.is_pending());
+
+		pool.set_nworkers(1);
+		BOOST_CHECK_EQUAL(inner.get(), 12);
+	}
+
+	// and abandoned on destruction
+	{
+		ext::future<int> inner;
+
+		{
+			ext::thread_pool pool(1, ext::thread_pool_flags::work_stealing);
+			auto f = pool.submit([&pool]
+			{
+				auto inner = pool.submit([] { return 12; });
+				return std::make_pair(std::move(inner), pool.set_nworkers(0));
+			});
+
+			auto res = f.get();
+			res.second.wait();
+			inner = std::move(res.first);
+		}
+
+		BOOST_CHECK(inner.is_abandoned());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(thread_pool_priority_tests)
+{
+	using ext::task_priority;
+	std::string order;
+	auto record = [&order](char ch) { order += ch; };
+
+	{	// strict: lanes are drained by priority, FIFO inside lane
+		ext::thread_pool pool(0);
+		std::vector<ext::future<void>> futures;
+		futures.push_back(pool.submit(task_priority::background, record, 'b'));
+		futures.push_back(pool.submit(record, 'n'));
+		futures.push_back(pool.submit(task_priority::high, record, 'h'));
+		futures.push_back(pool.submit(task_priority::high, record, 'H'));
+		futures.push_back(pool.submit(task_priority::normal, record, 'N'));
+
+		pool.set_nworkers(1);
+		for (auto & f : futures) f.wait();
+		BOOST_CHECK_EQUAL(order, "hHnNb");
+	}
+
+	order.clear();
+	{	// weighted: 2 high tasks per 1 normal
+		ext::thread_pool pool(0);
+		pool.set_priority_weights(2, 1, 1);
+
+		std::vector<ext::future<void>> futures;
+		for (unsigned u = 0; u < 4; ++u)
+		{
+			futures.push_back(pool.submit(task_priority::normal, record, 'n'));
+			futures.push_back(pool.submit(task_priority::high, record, 'h'));
+		}
+
+		pool.set_nworkers(1);
+		for (auto & f : futures) f.wait();
+		BOOST_CHECK_EQUAL(order, "hhnhhnnn");
+	}
+
+	order.clear();
+	{	// continuation tasks are placed into lane of their priority too
+		ext::thread_pool pool(0);
+		ext::promise<void> promise;
+
+		auto f1 = pool.submit(task_priority::background, promise.get_future(), [&](auto) { record('b'); });
+		promise.set_value();
+		auto f2 = pool.submit(task_priority::high, record, 'h');
+
+		pool.set_nworkers(1);
+		f1.wait(), f2.wait();
+		BOOST_CHECK_EQUAL(order, "hb");
+	}
+}
+
+BOOST_AUTO_TEST_CASE(thread_pool_idle_policy_tests)
+{
+	for (auto flags : {ext::thread_pool_flags::none, ext::thread_pool_flags::work_stealing})
+	{
+		ext::thread_pool pool(4, flags);
+		pool.set_idle_policy(1000, 10);
+
+		std::atomic_uint counter = 0;
+		for (unsigned round = 0; round < 100; ++round)
+		{
+			std::vector<ext::future<void>> futures;
+			for (unsigned u = 0; u < 10; ++u)
+				futures.push_back(pool.submit([&counter] { counter.fetch_add(1, std::memory_order_relaxed); }));
+
+			for (auto & f : futures) f.wait();
+		}
+
+		BOOST_CHECK_EQUAL(counter.load(), 1000);
+
+		// eventually all idle workers are parked
+		for (unsigned u = 0; u < 1000 and pool.get_nparked() != 4; ++u)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		BOOST_CHECK_EQUAL(pool.get_nparked(), 4);
+		BOOST_CHECK_EQUAL(pool.submit([] { return 1; }).get(), 1);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(thread_pool_lockfree_queue_tests)
+{
+	for (auto flags : {ext::thread_pool_flags::lockfree_queue, ext::thread_pool_flags::lockfree_queue | ext::thread_pool_flags::work_stealing})
+	{
+		ext::thread_pool pool(4, flags);
+		std::atomic_uint counter = 0;
+
+		// many concurrent producers
+		std::vector<std::thread> producers;
+		for (unsigned t = 0; t < 8; ++t)
+		{
+			producers.emplace_back([&pool, &counter]
+			{
+				std::vector<ext::future<void>> futures;
+				for (unsigned u = 0; u < 1000; ++u)
+					futures.push_back(pool.submit([&counter] { counter.fetch_add(1, std::memory_order_relaxed); }));
+
+				for (auto & f : futures) f.wait();
+			});
+		}
+
+		for (auto & thr : producers) thr.join();
+		BOOST_CHECK_EQUAL(counter.load(), 8000);
+	}
+
+	// more tasks than ring capacity: overflow goes into list
+	{
+		ext::thread_pool pool(0, ext::thread_pool_flags::lockfree_queue);
+		std::atomic_uint counter = 0;
+
+		std::vector<ext::future<void>> futures;
+		for (unsigned u = 0; u < 3000; ++u)
+			futures.push_back(pool.submit([&counter] { counter.fetch_add(1, std::memory_order_relaxed); }));
+
+		pool.set_nworkers(2);
+		for (auto & f : futures) f.wait();
+		BOOST_CHECK_EQUAL(counter.load(), 3000);
+	}
+
+	// clear abandons tasks in ring too
+	{
+		ext::thread_pool pool(0, ext::thread_pool_flags::lockfree_queue);
+		auto f1 = pool.submit([] { return 1; });
+		auto f2 = pool.submit(ext::task_priority::high, [] { return 2; });
+
+		pool.clear();
+		BOOST_CHECK(f1.is_abandoned());
+		BOOST_CHECK(f2.is_abandoned());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(thread_pool_stats_tests)
+{
+	ext::thread_pool pool(2);
+	ext::promise<void> promise;
+
+	std::vector<ext::future<void>> futures;
+	for (unsigned u = 0; u < 100; ++u)
+		futures.push_back(pool.submit([] { std::this_thread::sleep_for(std::chrono::microseconds(10)); }));
+
+	auto delayed = pool.submit(promise.get_future(), [](auto) {});
+	for (auto & f : futures) f.wait();
+
+	// future becomes ready before worker updates it's counters
+	auto stats = pool.stats();
+	for (unsigned u = 0; u < 1000 and stats.executed != 100; ++u)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		stats = pool.stats();
+	}
+
+	BOOST_CHECK_EQUAL(stats.submitted, 101u);
+	BOOST_CHECK_EQUAL(stats.executed, 100u);
+	BOOST_CHECK_EQUAL(stats.delayed, 1u);
+	BOOST_CHECK_EQUAL(stats.queue_depth, 0u);
+	BOOST_CHECK_EQUAL(std::accumulate(stats.queue_wait.begin(), stats.queue_wait.end(), std::uint64_t(0)), 100u);
+
+	BOOST_REQUIRE_EQUAL(stats.workers.size(), 2u);
+	BOOST_CHECK_EQUAL(stats.workers[0].executed + stats.workers[1].executed, 100u);
+	BOOST_CHECK(stats.workers[0].busy_time + stats.workers[1].busy_time >= std::chrono::microseconds(1000));
+
+	// stopped workers counters are kept in totals
+	pool.set_nworkers(0).wait();
+	auto pending = pool.submit([] {});
+	pool.clear();
+
+	stats = pool.stats();
+	BOOST_CHECK(stats.workers.empty());
+	BOOST_CHECK_EQUAL(stats.executed, 100u);
+	BOOST_CHECK_EQUAL(stats.abandoned, 2u);
+	BOOST_CHECK_EQUAL(stats.delayed, 0u);
+	BOOST_CHECK(delayed.is_abandoned());
+	BOOST_CHECK(pending.is_abandoned());
+}
+
+BOOST_AUTO_TEST_CASE(thread_pool_autoscaling_tests)
+{
+	ext::thread_pool pool(0);
+
+	ext::thread_pool_autoscale_options opts;
+	opts.min_workers = 1;
+	opts.max_workers = 4;
+	opts.interval = std::chrono::milliseconds(10);
+	opts.grow_wait = std::chrono::microseconds(100);
+
+	BOOST_CHECK_THROW(pool.enable_autoscaling({2, 1}), std::invalid_argument);
+
+	pool.enable_autoscaling(opts);
+	BOOST_CHECK_EQUAL(pool.get_nworkers(), 1u);
+
+	// backlog of tasks: pool grows
+	std::vector<ext::future<void>> futures;
+	for (unsigned u = 0; u < 300; ++u)
+		futures.push_back(pool.submit([] { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }));
+
+	unsigned max_seen = 0;
+	for (auto & f : futures)
+	{
+		f.wait();
+		max_seen = std::max(max_seen, pool.get_nworkers());
+	}
+
+	BOOST_CHECK_GT(max_seen, 1u);
+	BOOST_CHECK_LE(max_seen, 4u);
+
+	// idle pool shrinks back to minimum
+	for (unsigned u = 0; u < 2000 and pool.get_nworkers() != 1; ++u)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	BOOST_CHECK_EQUAL(pool.get_nworkers(), 1u);
+
+	pool.disable_autoscaling();
+	BOOST_CHECK_EQUAL(pool.submit([] { return 1; }).get(), 1);
+
+	// tasks longer than interval: workers are busy all the time, though no task finishes - pool should not shrink
+	ext::thread_pool busy_pool(4);
+	opts.interval = std::chrono::milliseconds(20);
+	busy_pool.enable_autoscaling(opts);
+
+	std::atomic_bool release = false;
+	std::vector<ext::future<void>> long_tasks;
+	for (unsigned u = 0; u < 4; ++u)
+		long_tasks.push_back(busy_pool.submit([&release]
+		{
+			for (unsigned n = 0; n < 1000 and not release.load(); ++n)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	BOOST_CHECK_EQUAL(busy_pool.get_nworkers(), 4u);
+
+	release = true;
+	for (auto & f : long_tasks) f.wait();
+	busy_pool.disable_autoscaling();
+}
+
+#if BOOST_OS_LINUX
+BOOST_AUTO_TEST_CASE(thread_pool_affinity_tests)
+{
+	auto thread_info = []
+	{
+		char name[16];
+		::pthread_getname_np(::pthread_self(), name, sizeof(name));
+
+		cpu_set_t set;
+		::sched_getaffinity(0, sizeof(set), &set);
+		return std::make_pair(std::string(name), CPU_COUNT(&set) == 1 and CPU_ISSET(0, &set));
+	};
+
+	ext::thread_pool pool(1);
+	pool.set_thread_name("test-pool-");
+	pool.set_affinity({0});
+
+	auto [name, pinned] = pool.submit(thread_info).get();
+	BOOST_CHECK_EQUAL(name, "test-pool-0");
+	BOOST_CHECK(pinned);
+
+	// applied to new workers too
+	pool.set_nworkers(0).wait();
+	pool.set_nworkers(1);
+
+	std::tie(name, pinned) = pool.submit(thread_info).get();
+	BOOST_CHECK_EQUAL(name, "test-pool-0");
+	BOOST_CHECK(pinned);
+
+	// invalid cpu set is rejected without changing anything
+	BOOST_CHECK_THROW(pool.set_affinity({CPU_SETSIZE}), std::system_error);
+	pool.set_affinity({});
+	std::tie(name, pinned) = pool.submit(thread_info).get();
+	BOOST_CHECK(not pinned or std::thread::hardware_concurrency() == 1);
+
+	// long prefix is truncated, index is kept
+	pool.set_thread_name("very-long-pool-name-");
+	std::tie(name, pinned) = pool.submit(thread_info).get();
+	BOOST_CHECK_EQUAL(name, "very-long-pool0");
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(future_then_executor_tests)
+{
+	using namespace std::chrono_literals;
+	ext::thread_pool pool(2);
+
+	auto pool_thread = [](auto f) { f.get(); return std::this_thread::get_id(); };
+
+	// continuation is executed on pool, not on thread satisfying promise
+	{
+		ext::promise<int> p;
+		auto f = p.get_future().then(pool, pool_thread);
+
+		std::thread thr([&p] { p.set_value(1); });
+		auto satisfier = thr.get_id();
+		thr.join();
+
+		auto id = f.get();
+		BOOST_CHECK(id != satisfier);
+		BOOST_CHECK(id != std::this_thread::get_id());
+	}
+
+	// ready future - submitted immediately, no delayed continuation
+	{
+		auto f = ext::make_ready_future(10).then(pool, [](auto f) { return f.get() + 1; });
+		BOOST_CHECK_EQUAL(f.get(), 11);
+		BOOST_CHECK_EQUAL(pool.stats().delayed, 0u);
+
+		auto g = ext::make_ready_future(20).then(pool, pool_thread);
+		BOOST_CHECK(g.get() != std::this_thread::get_id());
+	}
+
+	// shared_future and chaining
+	{
+		ext::promise<int> p;
+		auto sf = p.get_future().share();
+		auto f1 = sf.then(pool, [](auto f) { return f.get() * 2; });
+		auto f2 = sf.then(pool, [](auto f) { return f.get() * 3; })
+		            .then(pool, [](auto f) { return f.get() + 1; });
+
+		p.set_value(5);
+		BOOST_CHECK_EQUAL(f1.get(), 10);
+		BOOST_CHECK_EQUAL(f2.get(), 16);
+	}
+}
+
+namespace
+{
+	class counting_resource : public std::pmr::memory_resource
+	{
+	public:
+		std::atomic_uint allocated = 0, deallocated = 0;
+
+	protected:
+		void * do_allocate(std::size_t bytes, std::size_t alignment) override
+		{
+			++allocated;
+			return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+		}
+
+		void do_deallocate(void * ptr, std::size_t bytes, std::size_t alignment) override
+		{
+			++deallocated;
+			std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override { return this == &other; }
+	};
+}
+
+BOOST_AUTO_TEST_CASE(task_memory_resource_tests)
+{
+	counting_resource upstream;
+
+	{
+		ext::task_memory_resource resource(64, &upstream);
+		ext::thread_pool pool(4, ext::thread_pool_flags::none, &resource);
+		ext::threaded_scheduler scheduler(&resource);
+		BOOST_CHECK(pool.memory_resource() == &resource);
+
+		std::atomic_uint counter = 0;
+		auto task = [&counter] { counter.fetch_add(1, std::memory_order_relaxed); };
+
+		for (unsigned round = 0; round < 10; ++round)
+		{
+			std::vector<ext::future<void>> futures;
+			for (unsigned u = 0; u < 100; ++u)
+			{
+				futures.push_back(pool.submit(task));
+				futures.push_back(pool.submit(scheduler.submit(std::chrono::milliseconds(1), task), [task](auto) { task(); }));
+			}
+
+			for (auto & f : futures) f.get();
+		}
+
+		BOOST_CHECK_EQUAL(counter.load(), 3000);
+		// blocks are reused, only few slabs are taken from upstream
+		BOOST_CHECK_LT(upstream.allocated.load(), 100u);
+
+		// memory of abandoned tasks is returned too
+		pool.set_nworkers(0).wait();
+		auto f = pool.submit([] { return 1; });
+		pool.clear();
+		BOOST_CHECK(f.is_abandoned());
+	}
+
+	BOOST_CHECK_EQUAL(upstream.allocated.load(), upstream.deallocated.load());
+}
+
+BOOST_AUTO_TEST_CASE(future_memory_resource_tests)
+{
+	counting_resource resource;
+
+	{
+		// promise shared state
+		ext::promise<int> p(std::allocator_arg, &resource);
+		auto f = p.get_future();
+		BOOST_CHECK_EQUAL(resource.allocated, 1u);
+
+		// continuations
+		auto f1 = std::move(f).then(std::allocator_arg, &resource, [](auto f) { return f.get() + 1; });
+		auto sf = std::move(f1).share();
+		auto f2 = sf.then(std::allocator_arg, &resource, [](auto f) { return f.get() * 2; });
+		BOOST_CHECK_EQUAL(resource.allocated, 3u);
+
+		p.set_value(1);
+		BOOST_CHECK_EQUAL(f2.get(), 4);
+
+		// async tasks, both policies
+		auto a1 = ext::async(std::allocator_arg, &resource, ext::launch::async, [](int x) { return x * 10; }, 2);
+		auto a2 = ext::async(std::allocator_arg, &resource, ext::launch::deferred, [] { return 5; });
+		BOOST_CHECK_EQUAL(a1.get() + a2.get(), 25);
+		BOOST_CHECK_EQUAL(resource.allocated, 5u);
+
+		// null resource - global heap
+		auto a3 = ext::async(std::allocator_arg, nullptr, ext::launch::deferred, [] { return 1; });
+		BOOST_CHECK_EQUAL(a3.get(), 1);
+		BOOST_CHECK_EQUAL(resource.allocated, 5u);
+	}
+
+	// async thread can still hold it's reference for a moment
+	while (resource.deallocated != resource.allocated)
+		std::this_thread::yield();
+}
+
+BOOST_AUTO_TEST_CASE(thread_pool_bulk_tests)
+{
+	ext::thread_pool pool(4);
+
+	{
+		std::vector<int> input = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+		auto futures = pool.submit_bulk(input.begin(), input.end(), [](int val)
+		{
+			if (val == 5) throw std::runtime_error("5");
+			return val * 2;
+		});
+
+		BOOST_REQUIRE_EQUAL(futures.size(), input.size());
+		for (unsigned u = 0; u < input.size(); ++u)
+		{
+			if (input[u] == 5)
+				BOOST_CHECK_THROW(futures[u].get(), std::runtime_error);
+			else
+				BOOST_CHECK_EQUAL(futures[u].get(), input[u] * 2);
+		}
+	}
+
+	{
+		std::atomic_int sum = 0;
+		auto f = pool.parallel_for(boost::irange(0, 1000), 64, [&sum](int val) { sum.fetch_add(val, std::memory_order_relaxed); });
+		f.get();
+		BOOST_CHECK_EQUAL(sum.load(), 999 * 1000 / 2);
+	}
+
+	{
+		auto f = pool.parallel_for(boost::irange(0, 100), 10, [](int val) { if (val == 42) throw std::runtime_error("42"); });
+		BOOST_CHECK_THROW(f.get(), std::runtime_error);
+	}
+
+	{
+		std::vector<int> empty;
+		auto f = pool.parallel_for(empty, 0, [](int) {});
+		BOOST_CHECK(f.is_ready());
+	}
+
+	// not executed tasks are abandoned by clear
+	{
+		ext::thread_pool pool(0);
+		std::vector<int> input = {1, 2, 3};
+		auto futures = pool.submit_bulk(input.begin(), input.end(), [](int val) { return val; });
+		auto f = pool.parallel_for(std::move(input), 2, [](int) {});
+
+		pool.clear();
+		for (auto & fut : futures)
+			BOOST_CHECK(fut.is_abandoned());
+
+		BOOST_CHECK(f.is_abandoned());
+	}
+
+	// bulk blocks and parallel_for states are allocated from pool memory resource
+	{
+		counting_resource resource;
+		{
+			ext::thread_pool pool(2, ext::thread_pool_flags::none, &resource);
+			std::vector<int> input = {1, 2, 3};
+			auto futures = pool.submit_bulk(input.begin(), input.end(), [](int val) { return val; });
+			// block and it's task array
+			BOOST_CHECK_EQUAL(resource.allocated, 2u);
+
+			auto f = pool.parallel_for(boost::irange(0, 100), 10, [](int) {});
+			// state and it's chunks
+			BOOST_CHECK_EQUAL(resource.allocated, 4u);
+
+			for (auto & fut : futures) fut.get();
+			f.get();
+		}
+
+		// tasks can be released by workers a little after futures become ready
+		while (resource.deallocated != resource.allocated)
+			std::this_thread::yield();
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,12 @@
 #include <string>
 #include <map>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <random>
+#include <algorithm>
 #include <ext/lrucache.hpp>
+#include <ext/concurrent_lru_cache.hpp>
 
 #include <boost/test/unit_test.hpp>
 
@@ -75,3 +81,276 @@ BOOST_AUTO_TEST_CASE(lru_cache_test)
 	BOOST_CHECK(counters[12] == 2);
 	BOOST_CHECK(counters[14] == 2);
 }
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_cache_test)
+{
+	for (auto mode : {ext::lru_update_mode::immediate, ext::lru_update_mode::buffered})
+	{
+		std::atomic_uint acquired = 0;
+		auto source = [&acquired] (int k)
+		{
+			++acquired;
+			return std::to_string(k);
+		};
+
+		// single shard - exact lru
+		ext::concurrent_lru_cache<int, std::string> cache {5, source, 1, mode};
+		BOOST_CHECK_EQUAL(cache.shard_count(), 1u);
+		BOOST_CHECK(not cache.find(10));
+
+		for (int k = 10; k < 15; ++k)
+			BOOST_CHECK_EQUAL(cache.at(k), std::to_string(k));
+
+		BOOST_CHECK_EQUAL(acquired.load(), 5u);
+		BOOST_CHECK_EQUAL(*cache.find(10), "10");
+
+		// 11 is least recently used. In buffered mode access to 10 is applied by insert
+		cache.insert(15, "15");
+		BOOST_CHECK(cache.find(10));
+		BOOST_CHECK(not cache.find(11));
+		BOOST_CHECK_EQUAL(cache.size(), 5u);
+
+		BOOST_CHECK(cache.erase(15));
+		BOOST_CHECK(not cache.erase(15));
+
+		cache.set_maxsize(2);
+		BOOST_CHECK_EQUAL(cache.size(), 2u);
+		BOOST_CHECK_THROW(cache.set_maxsize(0), std::invalid_argument);
+
+		cache.clear();
+		BOOST_CHECK_EQUAL(cache.size(), 0u);
+	}
+
+	// many threads over sharded cache
+	for (auto mode : {ext::lru_update_mode::immediate, ext::lru_update_mode::buffered})
+	{
+		ext::concurrent_lru_cache<int, std::string> cache {64, [] (int k) { return std::to_string(k); }, 8, mode};
+		BOOST_CHECK_EQUAL(cache.shard_count(), 8u);
+
+		std::atomic_bool ok = true;
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; ++t)
+		{
+			threads.emplace_back([&cache, &ok, t]
+			{
+				for (int i = 0; i < 10000; ++i)
+				{
+					int k = (i * (t + 1)) % 200;
+					if (cache.at(k) != std::to_string(k))
+						ok = false;
+				}
+			});
+		}
+
+		for (auto & thr : threads)
+			thr.join();
+
+		BOOST_CHECK(ok.load());
+		BOOST_CHECK_LE(cache.size(), 64u);
+
+		// capacity is split exactly between shards, sizes below shard count can't be honored
+		cache.set_maxsize(10);
+		BOOST_CHECK_EQUAL(cache.maxsize(), 10u);
+		for (int k = 0; k < 200; ++k)
+			cache.insert(k, std::to_string(k));
+
+		BOOST_CHECK_LE(cache.size(), 10u);
+		BOOST_CHECK_THROW(cache.set_maxsize(2), std::invalid_argument);
+		BOOST_CHECK_EQUAL(cache.maxsize(), 10u);
+		BOOST_CHECK_LE(cache.size(), 10u);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(weighted_lru_cache_test)
+{
+	auto weigher = [] (int, const std::string & val) { return val.size(); };
+	ext::manual_lru_cache<int, std::string, boost::hash<int>, std::equal_to<>, decltype(weigher)> cache {10, weigher};
+
+	cache.insert(1, "aaaa");
+	cache.insert(2, "bbbb");
+	BOOST_CHECK_EQUAL(cache.weight(), 8u);
+
+	// 6 bytes more - 1 should be evicted
+	cache.insert(3, "cccccc");
+	BOOST_CHECK(cache.find_ptr(1) == nullptr);
+	BOOST_CHECK_EQUAL(cache.size(), 2u);
+	BOOST_CHECK_EQUAL(cache.weight(), 10u);
+
+	// replacing value updates weight, grown element pushes out others
+	cache.insert(2, "bbbbbbbb");
+	BOOST_CHECK(cache.find_ptr(3) == nullptr);
+	BOOST_CHECK_EQUAL(cache.weight(), 8u);
+
+	// element heavier than budget is kept alone
+	cache.insert(4, std::string(20, 'd'));
+	BOOST_CHECK_EQUAL(cache.size(), 1u);
+	BOOST_CHECK_EQUAL(cache.weight(), 20u);
+
+	cache.insert(5, "e");
+	BOOST_CHECK(cache.find_ptr(4) == nullptr);
+	BOOST_CHECK_EQUAL(cache.weight(), 1u);
+
+	cache.insert(6, "ffff");
+	cache.insert(7, "gggg");
+	cache.drop_to(5);
+	BOOST_CHECK_EQUAL(cache.size(), 1u);
+	BOOST_CHECK_EQUAL(cache.weight(), 4u);
+
+	cache.insert(8, "hhhh");
+	cache.set_maxsize(4);
+	BOOST_CHECK_EQUAL(cache.size(), 1u);
+	BOOST_CHECK(cache.find_ptr(8) != nullptr);
+
+	cache.clear();
+	BOOST_CHECK_EQUAL(cache.weight(), 0u);
+
+	// budget of concurrent cache is split between shards
+	ext::concurrent_lru_cache<int, std::string, boost::hash<int>, std::equal_to<>,
+		std::function<std::string(const int &)>, decltype(weigher)> shared {100, nullptr, 4, ext::lru_update_mode::immediate, weigher};
+	for (int k = 0; k < 100; ++k)
+		shared.insert(k, "0123456789");
+
+	BOOST_CHECK_LE(shared.weight(), 100u);
+	BOOST_CHECK_EQUAL(shared.weight(), shared.size() * 10);
+
+	// unit weigher: weight is count
+	ext::lru_cache<int, std::string> counted {3, [] (int k) { return std::to_string(k); }};
+	counted.at(100);
+	counted.at(2);
+	BOOST_CHECK_EQUAL(counted.weight(), counted.size());
+}
+
+template <class Policy>
+static void check_policy_basics()
+{
+	ext::manual_lru_cache<int, std::string, boost::hash<int>, std::equal_to<>, ext::lru_unit_weigher, Policy> cache {10};
+
+	for (int k = 0; k < 10; ++k)
+		cache.insert(k, std::to_string(k));
+
+	BOOST_CHECK_EQUAL(cache.size(), 10u);
+	BOOST_CHECK(cache.find_ptr(5) and *cache.find_ptr(5) == "5");
+
+	// new element is never evicted by it's own insert
+	cache.insert(100, "100");
+	BOOST_CHECK_EQUAL(cache.size(), 10u);
+	BOOST_CHECK(cache.peek_ptr(100) != nullptr);
+
+	cache.insert(5, "five");
+	BOOST_CHECK_EQUAL(cache.at(5), "five");
+	BOOST_CHECK(cache.erase(5));
+	BOOST_CHECK(not cache.erase(5));
+	BOOST_CHECK_EQUAL(cache.size(), 9u);
+
+	cache.drop_last();
+	BOOST_CHECK_EQUAL(cache.size(), 8u);
+	cache.set_maxsize(4);
+	BOOST_CHECK_EQUAL(cache.size(), 4u);
+	cache.clear();
+	BOOST_CHECK_EQUAL(cache.size(), 0u);
+
+	// random mix of operations with weights, checks bookkeeping stays consistent
+	auto weigher = [] (int, const std::string & val) { return val.size(); };
+	ext::manual_lru_cache<int, std::string, boost::hash<int>, std::equal_to<>, decltype(weigher), Policy> weighted {64, weigher};
+
+	std::mt19937 gen(42);
+	for (unsigned i = 0; i < 20000; ++i)
+	{
+		int key = gen() % 200;
+		switch (gen() % 8)
+		{
+			case 0:  weighted.erase(key); break;
+			case 1:
+			case 2:  weighted.insert(key, std::string(1 + gen() % 8, 'x')); break;
+			default: weighted.find_ptr(key); break;
+		}
+
+		BOOST_REQUIRE_LE(weighted.weight(), 64u);
+	}
+
+	while (weighted.size()) weighted.drop_last();
+	BOOST_CHECK_EQUAL(weighted.weight(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(lru_cache_policies_test)
+{
+	check_policy_basics<ext::lru_policy>();
+	check_policy_basics<ext::clock_policy>();
+	check_policy_basics<ext::arc_policy>();
+	check_policy_basics<ext::tinylfu_policy>();
+
+	// clock: referenced element gets second chance
+	ext::manual_lru_cache<int, int, boost::hash<int>, std::equal_to<>, ext::lru_unit_weigher, ext::clock_policy> clock {3};
+	clock.insert(1, 1);
+	clock.insert(2, 2);
+	clock.insert(3, 3);
+	clock.find_ptr(1);
+	clock.insert(4, 4);
+	BOOST_CHECK(clock.peek_ptr(1) != nullptr);
+	BOOST_CHECK(clock.peek_ptr(2) == nullptr);
+
+	ext::lru_cache<int, std::string, boost::hash<int>, std::equal_to<>,
+		std::function<std::string(const int &)>, ext::lru_unit_weigher, ext::tinylfu_policy> acquiring {2, [] (int k) { return std::to_string(k); }};
+	BOOST_CHECK_EQUAL(acquiring.at(1), "1");
+	BOOST_CHECK_EQUAL(acquiring.at(2), "2");
+	BOOST_CHECK_EQUAL(acquiring.at(3), "3");
+	BOOST_CHECK_EQUAL(acquiring.size(), 2u);
+
+	ext::concurrent_lru_cache<int, int, boost::hash<int>, std::equal_to<>,
+		std::function<int(const int &)>, ext::lru_unit_weigher, ext::arc_policy> shared {64, [] (int k) { return k; }, 4};
+	for (int k = 0; k < 1000; ++k)
+		BOOST_CHECK_EQUAL(shared.at(k % 100), k % 100);
+
+	BOOST_CHECK_LE(shared.size(), 64u);
+}
+
+/// replays trace through cache with given policy, returns hit rate
+template <class Policy>
+static double replay_trace(const std::vector<int> & trace, std::size_t capacity)
+{
+	ext::manual_lru_cache<int, int, boost::hash<int>, std::equal_to<>, ext::lru_unit_weigher, Policy> cache {capacity};
+	std::size_t hits = 0;
+	for (int key : trace)
+	{
+		if (cache.find_ptr(key)) ++hits;
+		else cache.insert(key, key);
+	}
+
+	return double(hits) / trace.size();
+}
+
+BOOST_AUTO_TEST_CASE(lru_cache_policies_hit_rate_test)
+{
+	// synthetic trace: zipf distributed working set interleaved with one-time scans, which flush plain lru
+	const std::size_t capacity = 500, hot_keys = 2000;
+	const unsigned rounds = 20, hot_accesses = 5000, scan_length = 1000;
+
+	std::vector<double> cdf(hot_keys);
+	double sum = 0;
+	for (std::size_t k = 0; k < hot_keys; ++k)
+		cdf[k] = sum += 1.0 / (k + 1);
+
+	std::mt19937 gen(12345);
+	std::vector<int> trace;
+	int scan_key = static_cast<int>(hot_keys);
+	for (unsigned round = 0; round < rounds; ++round)
+	{
+		for (unsigned i = 0; i < hot_accesses; ++i)
+		{
+			double u = gen() / (double(gen.max()) + 1) * sum;
+			trace.push_back(static_cast<int>(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()));
+		}
+
+		for (unsigned i = 0; i < scan_length; ++i)
+			trace.push_back(scan_key++);
+	}
+
+	auto lru     = replay_trace<ext::lru_policy>(trace, capacity);
+	auto clock   = replay_trace<ext::clock_policy>(trace, capacity);
+	auto arc     = replay_trace<ext::arc_policy>(trace, capacity);
+	auto tinylfu = replay_trace<ext::tinylfu_policy>(trace, capacity);
+
+	BOOST_TEST_MESSAGE("hit rates: lru " << lru << ", clock " << clock << ", arc " << arc << ", tinylfu " << tinylfu);
+	BOOST_CHECK_GT(arc, lru);
+	BOOST_CHECK_GT(tinylfu, lru);
+}